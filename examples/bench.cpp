@@ -0,0 +1,486 @@
+// bench.cpp
+#include <audio.hpp>
+#include <logits.hpp>
+#include <moonshine.hpp>
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+#endif
+
+const int SAMPLE_RATE = 16000;
+
+struct BenchConfig
+{
+    std::string models_dir;                                ///< Directory of the ONNX models.
+    std::vector<std::string> wav_files;                    ///< Corpus; synthetic audio if empty.
+    std::vector<double> lengths = {2.0, 5.0, 10.0, 20.0};  ///< Synthetic clip lengths.
+    std::vector<int> threads = {1};                        ///< Intra-op thread counts to sweep.
+    std::vector<std::string> precisions;                   ///< Model precisions; fp32 if empty.
+    std::vector<size_t> batches = {1};                     ///< Batch sizes to sweep.
+    size_t beam_width = 1;                                 ///< Beam width of batch-1 runs.
+    size_t iterations = 10;                                ///< Timed runs per measurement.
+    size_t warmup = 1;                                     ///< Untimed runs per measurement.
+    size_t instances = 1;                                  ///< Models loaded per configuration.
+    bool share_decoder_weights = true;                     ///< RuntimeOptions setting to use.
+    std::string output;                                    ///< JSON file; stdout if empty.
+};
+
+struct BenchInput
+{
+    std::string name;
+    std::vector<float> audio;
+};
+
+// Deterministic speech-band tone with noise, so runs are comparable across machines
+std::vector<float> syntheticAudio(double seconds)
+{
+    std::vector<float> audio(static_cast<size_t>(seconds * SAMPLE_RATE));
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < audio.size(); ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        const float noise = static_cast<float>(seed >> 8) / 16777216.0f - 0.5f;
+        audio[i] = 0.3f * std::sin(2.0f * 3.14159265f * 220.0f * i / SAMPLE_RATE) + 0.05f * noise;
+    }
+    return audio;
+}
+
+// Peak resident set size of the process in bytes. It never decreases, so it cannot be
+// attributed to whatever ran last; use currentRss() deltas for that.
+size_t peakRss()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);  // Bytes on macOS
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;  // Kilobytes on Linux
+#endif
+#endif
+}
+
+// Current resident set size of the process in bytes, or 0 if unavailable
+size_t currentRss()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return counters.WorkingSetSize;
+    }
+    return 0;
+#elif defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info),
+                  &count) == KERN_SUCCESS)
+    {
+        return static_cast<size_t>(info.resident_size);
+    }
+    return 0;
+#else
+    // The second field of statm is the resident size in pages
+    std::ifstream statm("/proc/self/statm");
+    size_t total_pages = 0;
+    size_t resident_pages = 0;
+    if (statm >> total_pages >> resident_pages)
+    {
+        return resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    }
+    return 0;
+#endif
+}
+
+// Growth of the resident set since an earlier currentRss(); negative if memory was returned
+int64_t rssGrowth(size_t before)
+{
+    return static_cast<int64_t>(currentRss()) - static_cast<int64_t>(before);
+}
+
+// Nearest-rank percentile of sorted values
+double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0.0;
+    }
+    const size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[std::min(sorted.size() - 1, rank == 0 ? 0 : rank - 1)];
+}
+
+// Token-level Levenshtein distance, for comparing a transcript against a reference
+size_t editDistance(const std::vector<int32_t> &a, const std::vector<int32_t> &b)
+{
+    std::vector<size_t> row(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); ++j)
+    {
+        row[j] = j;
+    }
+    for (size_t i = 1; i <= a.size(); ++i)
+    {
+        size_t diagonal = row[0];
+        row[0] = i;
+        for (size_t j = 1; j <= b.size(); ++j)
+        {
+            const size_t substitution = diagonal + (a[i - 1] == b[j - 1] ? 0 : 1);
+            diagonal = row[j];
+            row[j] = std::min({row[j] + 1, row[j - 1] + 1, substitution});
+        }
+    }
+    return row[b.size()];
+}
+
+template <typename T>
+std::vector<T> parseList(const std::string &text)
+{
+    std::vector<T> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        std::stringstream item_stream(item);
+        T value;
+        if (!(item_stream >> value))
+        {
+            throw std::runtime_error("Invalid list value: " + item);
+        }
+        values.push_back(value);
+    }
+    return values;
+}
+
+void printUsage(const char *program)
+{
+    std::cerr << "Usage: " << program << " <models_dir> [options]\n"
+              << "  --wav <file>         Add a WAV file to the corpus, resampled to 16 kHz mono;\n"
+              << "                       may be repeated. Without it, synthetic audio is used.\n"
+              << "  --lengths <s,...>    Synthetic clip lengths in seconds (default 2,5,10,20)\n"
+              << "  --threads <n,...>    Intra-op thread counts to sweep (default 1)\n"
+              << "  --precision <p>      Model precision to sweep: fp32, fp16, int8, mixed or\n"
+              << "                       e.g. encode=int8,decode=int8; may be repeated. The\n"
+              << "                       transcripts of the first are the accuracy reference.\n"
+              << "  --batch <n,...>      Batch sizes to sweep (default 1)\n"
+              << "  --beam <n>           Beam width of batch-1 runs (default 1, greedy)\n"
+              << "  --iterations <n>     Timed runs per measurement (default 10)\n"
+              << "  --warmup <n>         Untimed runs per measurement (default 1)\n"
+              << "  --instances <n>      Models to load per configuration, to measure the\n"
+              << "                       memory each further one adds (default 1)\n"
+              << "  --share-weights <b>  Share decoder weights across sessions and models,\n"
+              << "                       0 or 1 (default 1)\n"
+              << "  --output <file>      Write the JSON report to a file instead of stdout\n";
+}
+
+BenchConfig parseArgs(int argc, char *argv[])
+{
+    BenchConfig config;
+    config.models_dir = argv[1];
+    for (int i = 2; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            throw std::runtime_error("Missing value for " + arg);
+        }
+        const std::string value = argv[++i];
+        if (arg == "--wav")
+        {
+            config.wav_files.push_back(value);
+        }
+        else if (arg == "--lengths")
+        {
+            config.lengths = parseList<double>(value);
+        }
+        else if (arg == "--threads")
+        {
+            config.threads = parseList<int>(value);
+        }
+        else if (arg == "--precision")
+        {
+            config.precisions.push_back(value);
+        }
+        else if (arg == "--batch")
+        {
+            config.batches = parseList<size_t>(value);
+        }
+        else if (arg == "--beam")
+        {
+            config.beam_width = std::max<size_t>(1, std::stoul(value));
+        }
+        else if (arg == "--iterations")
+        {
+            config.iterations = std::max<size_t>(1, std::stoul(value));
+        }
+        else if (arg == "--warmup")
+        {
+            config.warmup = std::stoul(value);
+        }
+        else if (arg == "--instances")
+        {
+            config.instances = std::max<size_t>(1, std::stoul(value));
+        }
+        else if (arg == "--share-weights")
+        {
+            config.share_decoder_weights = std::stoi(value) != 0;
+        }
+        else if (arg == "--output")
+        {
+            config.output = value;
+        }
+        else
+        {
+            throw std::runtime_error("Unknown option: " + arg);
+        }
+    }
+    if (config.precisions.empty())
+    {
+        config.precisions.push_back("fp32");
+    }
+    return config;
+}
+
+// Time one inference of a batch of copies of the input; returns seconds and token count
+std::pair<double, size_t> runOnce(MoonshineModel &model, const BenchInput &input, size_t batch,
+                                  size_t beam_width)
+{
+    auto start = std::chrono::steady_clock::now();
+    size_t tokens = 0;
+    if (batch == 1)
+    {
+        GenerateOptions options;
+        options.beam_width = beam_width;
+        tokens = model.generate(input.audio.data(), input.audio.size(), options).tokens.size() - 1;
+    }
+    else
+    {
+        std::vector<std::vector<float>> audio_batch(batch, input.audio);
+        start = std::chrono::steady_clock::now();
+        for (const auto &sequence : model.generate_batch(audio_batch))
+        {
+            tokens += sequence.size() - 1;
+        }
+    }
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    return {duration.count(), tokens};
+}
+
+nlohmann::json measure(MoonshineModel &model, const BenchInput &input, size_t batch,
+                       const BenchConfig &config)
+{
+    const size_t rss_before = currentRss();
+    for (size_t i = 0; i < config.warmup; ++i)
+    {
+        runOnce(model, input, batch, config.beam_width);
+    }
+
+    std::vector<double> latencies;
+    size_t tokens = 0;
+    for (size_t i = 0; i < config.iterations; ++i)
+    {
+        auto [seconds, run_tokens] = runOnce(model, input, batch, config.beam_width);
+        latencies.push_back(seconds);
+        tokens += run_tokens;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    double total = 0.0;
+    for (double latency : latencies)
+    {
+        total += latency;
+    }
+    const double audio_seconds = static_cast<double>(input.audio.size()) / SAMPLE_RATE;
+    const double mean = total / latencies.size();
+
+    nlohmann::json result;
+    result["input"] = input.name;
+    result["audio_seconds"] = audio_seconds;
+    result["batch"] = batch;
+    result["beam_width"] = batch == 1 ? config.beam_width : 1;
+    result["iterations"] = latencies.size();
+    result["latency_seconds"] = {{"mean", mean},
+                                 {"p50", percentile(latencies, 50)},
+                                 {"p95", percentile(latencies, 95)},
+                                 {"p99", percentile(latencies, 99)},
+                                 {"min", latencies.front()},
+                                 {"max", latencies.back()}};
+    // Processing time per second of audio, counting every utterance of the batch
+    result["real_time_factor"] = mean / (audio_seconds * batch);
+    result["tokens_per_second"] = total > 0.0 ? tokens / total : 0.0;
+    result["tokens_per_utterance"] = static_cast<double>(tokens) / (latencies.size() * batch);
+    // Memory this measurement added, e.g. for its batch size; the process peak only shows
+    // the largest measurement so far
+    result["rss_growth_bytes"] = rssGrowth(rss_before);
+    result["process_peak_rss_bytes"] = peakRss();
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // Progress messages, including the library's, go to stderr so stdout holds only JSON
+    std::ostream json_out(std::cout.rdbuf());
+    std::cout.rdbuf(std::cerr.rdbuf());
+
+    try
+    {
+        BenchConfig config = parseArgs(argc, argv);
+
+        std::vector<BenchInput> inputs;
+        for (const auto &wav_file : config.wav_files)
+        {
+            inputs.push_back({wav_file, loadAudio(wav_file)});
+        }
+        if (inputs.empty())
+        {
+            for (double length : config.lengths)
+            {
+                std::ostringstream name;
+                name << "synthetic_" << length << "s";
+                inputs.push_back({name.str(), syntheticAudio(length)});
+            }
+        }
+
+        nlohmann::json report;
+        report["onnxruntime_version"] = Ort::GetVersionString();
+        report["hardware_threads"] = std::thread::hardware_concurrency();
+        report["logits_kernel"] = logitsKernel() == LogitsKernel::Avx2   ? "avx2"
+                                  : logitsKernel() == LogitsKernel::Neon ? "neon"
+                                                                         : "scalar";
+        report["reference_precision"] = config.precisions.front();
+        report["iterations"] = config.iterations;
+        report["warmup"] = config.warmup;
+        report["runs"] = nlohmann::json::array();
+
+        // Transcripts of the first precision, which the others are scored against
+        std::vector<std::vector<int32_t>> reference;
+        for (const std::string &precision : config.precisions)
+        {
+            for (int threads : config.threads)
+            {
+                RuntimeOptions options;
+                options.intra_op_num_threads = threads;
+                options.precision = parseModelPrecisions(precision);
+                options.share_decoder_weights = config.share_decoder_weights;
+
+                // Cold start: session creation, then the first inference on fresh sessions
+                const size_t rss_before_load = currentRss();
+                auto start = std::chrono::steady_clock::now();
+                MoonshineModel model(config.models_dir, options);
+                const int64_t model_rss = rssGrowth(rss_before_load);
+                std::chrono::duration<double> load = std::chrono::steady_clock::now() - start;
+                const double first_inference =
+                    runOnce(model, inputs.front(), 1, config.beam_width).first;
+
+                // Further models from the same files; with shared decoder weights, these add
+                // no decoder weights or packed buffers
+                std::vector<std::unique_ptr<MoonshineModel>> instances;
+                nlohmann::json instance_rss = nlohmann::json::array();
+                for (size_t i = 1; i < config.instances; ++i)
+                {
+                    const size_t rss_before_instance = currentRss();
+                    instances.push_back(
+                        std::make_unique<MoonshineModel>(config.models_dir, options));
+                    instance_rss.push_back(rssGrowth(rss_before_instance));
+                }
+
+                nlohmann::json run;
+                run["precision"] = precision;
+                run["intra_op_threads"] = threads;
+                run["cold_start_seconds"] = {{"load", load.count()},
+                                             {"first_inference", first_inference},
+                                             {"total", load.count() + first_inference}};
+                run["share_decoder_weights"] = options.share_decoder_weights;
+                run["model_rss_bytes"] = model_rss;
+                run["instance_rss_bytes"] = instance_rss;
+                run["measurements"] = nlohmann::json::array();
+                for (size_t batch : config.batches)
+                {
+                    for (const auto &input : inputs)
+                    {
+                        std::cerr << "precision=" << precision << " threads=" << threads
+                                  << " batch=" << batch << " input=" << input.name << "\n";
+                        run["measurements"].push_back(measure(model, input, batch, config));
+                    }
+                }
+
+                // Accuracy as the token error rate against the reference transcripts; on real
+                // speech this tracks the word error rate the precision costs
+                size_t errors = 0;
+                size_t reference_tokens = 0;
+                run["transcripts"] = nlohmann::json::array();
+                for (size_t i = 0; i < inputs.size(); ++i)
+                {
+                    std::vector<int32_t> tokens = model.generate(inputs[i].audio);
+                    if (reference.size() < inputs.size())
+                    {
+                        reference.push_back(tokens);
+                    }
+                    const size_t distance = editDistance(tokens, reference[i]);
+                    errors += distance;
+                    reference_tokens += reference[i].size();
+                    run["transcripts"].push_back({{"input", inputs[i].name},
+                                                  {"text", model.detokenize(tokens)},
+                                                  {"token_edits_vs_reference", distance}});
+                }
+                run["token_error_rate_vs_reference"] =
+                    reference_tokens > 0 ? static_cast<double>(errors) / reference_tokens : 0.0;
+                report["runs"].push_back(run);
+            }
+        }
+        report["process_peak_rss_bytes"] = peakRss();
+
+        if (config.output.empty())
+        {
+            json_out << report.dump(2) << "\n";
+        }
+        else
+        {
+            std::ofstream output(config.output);
+            output << report.dump(2) << "\n";
+        }
+    }
+    catch (const Ort::Exception &e)
+    {
+        std::cerr << "ONNX Runtime error: " << e.what() << "\n";
+        return 1;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,329 @@
+// concurrency_test.cpp
+#include <audio.hpp>
+#include <moonshine.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+const int SAMPLE_RATE = 16000;
+
+struct TestConfig
+{
+    std::string models_dir;  ///< Directory of the ONNX models.
+    std::string wav_file;    ///< Speech to transcribe; synthetic audio if empty.
+    size_t threads = 4;      ///< Threads calling the model at once.
+    size_t rounds = 3;       ///< Passes over the clips per thread.
+};
+
+struct TestClip
+{
+    std::string name;
+    std::vector<float> audio;
+    std::vector<int32_t> expected;  // Tokens of a serial run
+};
+
+// Collects failures from all threads; the test fails if there are any
+class Failures
+{
+   public:
+    void add(const std::string &message)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::cerr << "FAIL: " << message << "\n";
+        ++count_;
+    }
+
+    size_t count()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return count_;
+    }
+
+   private:
+    std::mutex mutex_;
+    size_t count_ = 0;
+};
+
+// Deterministic speech-band tone with noise, as in the benchmark
+std::vector<float> syntheticAudio(double seconds)
+{
+    std::vector<float> audio(static_cast<size_t>(seconds * SAMPLE_RATE));
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < audio.size(); ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        const float noise = static_cast<float>(seed >> 8) / 16777216.0f - 0.5f;
+        audio[i] = 0.3f * std::sin(2.0f * 3.14159265f * 220.0f * i / SAMPLE_RATE) + 0.05f * noise;
+    }
+    return audio;
+}
+
+std::string describe(const std::vector<int32_t> &tokens)
+{
+    std::string text;
+    for (int32_t token : tokens)
+    {
+        text += (text.empty() ? "" : " ") + std::to_string(token);
+    }
+    return "[" + text + "]";
+}
+
+void expectTokens(Failures &failures, const std::string &what, const std::vector<int32_t> &actual,
+                  const std::vector<int32_t> &expected)
+{
+    if (actual != expected)
+    {
+        failures.add(what + ": got " + describe(actual) + ", expected " + describe(expected));
+    }
+}
+
+// Clips of different lengths, so that concurrent calls are at different decoder steps
+std::vector<TestClip> makeClips(const TestConfig &config)
+{
+    std::vector<TestClip> clips;
+    if (config.wav_file.empty())
+    {
+        for (int seconds : {1, 3, 6})
+        {
+            clips.push_back(
+                {"synthetic " + std::to_string(seconds) + " s", syntheticAudio(seconds), {}});
+        }
+        return clips;
+    }
+
+    const std::vector<float> audio = loadAudio(config.wav_file);
+    for (size_t parts : {1, 2, 3})
+    {
+        const size_t length = std::min(audio.size() / parts, static_cast<size_t>(20 * SAMPLE_RATE));
+        clips.push_back({config.wav_file + " / " + std::to_string(parts),
+                         std::vector<float>(audio.begin(), audio.begin() + length), {}});
+    }
+    return clips;
+}
+
+// Every thread runs every clip, each starting at a different clip, and must get the tokens of
+// the serial run
+void testGenerate(MoonshineModel &model, const std::vector<TestClip> &clips,
+                  const TestConfig &config, Failures &failures)
+{
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < config.threads; ++t)
+    {
+        threads.emplace_back(
+            [&, t]
+            {
+                for (size_t i = 0; i < config.rounds * clips.size(); ++i)
+                {
+                    const TestClip &clip = clips[(t + i) % clips.size()];
+                    expectTokens(failures, "generate " + clip.name, model.generate(clip.audio),
+                                 clip.expected);
+                }
+            });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+// Half the threads share a token that is cancelled once they have produced a token; the
+// others run alongside without one and must not be affected
+void testCancellation(MoonshineModel &model, const std::vector<TestClip> &clips,
+                      const TestConfig &config, Failures &failures)
+{
+    const TestClip &clip = clips.back();
+    CancellationToken cancel;
+    std::atomic<size_t> produced(0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < std::max<size_t>(2, config.threads); ++t)
+    {
+        const bool cancellable = t % 2 == 0;
+        threads.emplace_back(
+            [&, cancellable]
+            {
+                GenerateOptions options;
+                if (cancellable)
+                {
+                    options.cancel = &cancel;
+                    options.on_token = [&](const GeneratedToken &)
+                    {
+                        ++produced;
+                        return true;
+                    };
+                }
+                const GenerateResult result =
+                    model.generate(clip.audio.data(), clip.audio.size(), options);
+                if (!cancellable || result.stop_reason != StopReason::Cancelled)
+                {
+                    expectTokens(failures, "uncancelled " + clip.name, result.tokens,
+                                 clip.expected);
+                }
+                else if (result.tokens.size() > clip.expected.size() ||
+                         !std::equal(result.tokens.begin(), result.tokens.end(),
+                                     clip.expected.begin()))
+                {
+                    failures.add("cancelled " + clip.name + ": " + describe(result.tokens) +
+                                 " is not a prefix of " + describe(clip.expected));
+                }
+            });
+    }
+
+    // Calls that finish before the cancel are checked like uncancelled ones
+    const auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(30);
+    while (produced == 0 && std::chrono::steady_clock::now() < give_up)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    cancel.cancel();
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    GenerateOptions options;
+    options.cancel = &cancel;
+    const GenerateResult late = model.generate(clip.audio.data(), clip.audio.size(), options);
+    if (late.stop_reason != StopReason::Cancelled)
+    {
+        failures.add("a call started after cancel() was not cancelled");
+    }
+}
+
+// Long-form calls, which decode their chunks on threads of their own, run alongside generate()
+// calls and must match their serial runs
+void testLongForm(MoonshineModel &model, const std::vector<TestClip> &clips,
+                  const TestConfig &config, Failures &failures)
+{
+    std::vector<float> long_audio;
+    while (long_audio.size() < static_cast<size_t>(50 * SAMPLE_RATE))
+    {
+        for (const TestClip &clip : clips)
+        {
+            long_audio.insert(long_audio.end(), clip.audio.begin(), clip.audio.end());
+            long_audio.insert(long_audio.end(), SAMPLE_RATE / 2, 0.0f);
+        }
+    }
+
+    LongFormOptions long_form;
+    long_form.num_threads = 2;
+    const std::vector<int32_t> expected = model.transcribe_long(long_audio, long_form);
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < std::max<size_t>(2, config.threads); ++t)
+    {
+        threads.emplace_back(
+            [&, t]
+            {
+                if (t % 2 == 0)
+                {
+                    expectTokens(failures, "transcribe_long",
+                                 model.transcribe_long(long_audio, long_form), expected);
+                    return;
+                }
+                for (size_t i = 0; i < config.rounds * clips.size(); ++i)
+                {
+                    const TestClip &clip = clips[(t + i) % clips.size()];
+                    expectTokens(failures, "generate beside transcribe_long " + clip.name,
+                                 model.generate(clip.audio), clip.expected);
+                }
+            });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void printUsage(const char *program)
+{
+    std::cerr << "Usage: " << program << " <models_dir> [wav_file] [options]\n"
+              << "  Checks that concurrent calls on one model give the tokens of serial runs.\n"
+              << "  --threads <n>     Threads calling the model at once (default 4)\n"
+              << "  --rounds <n>      Passes over the clips per thread (default 3)\n";
+}
+
+TestConfig parseArgs(int argc, char *argv[])
+{
+    TestConfig config;
+    config.models_dir = argv[1];
+    for (int i = 2; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0)
+        {
+            config.wav_file = arg;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            throw std::runtime_error("Missing value for " + arg);
+        }
+        const std::string value = argv[++i];
+        if (arg == "--threads")
+        {
+            config.threads = std::max<size_t>(1, std::stoul(value));
+        }
+        else if (arg == "--rounds")
+        {
+            config.rounds = std::max<size_t>(1, std::stoul(value));
+        }
+        else
+        {
+            throw std::runtime_error("Unknown option: " + arg);
+        }
+    }
+    return config;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        const TestConfig config = parseArgs(argc, argv);
+        MoonshineModel model(config.models_dir);
+
+        std::vector<TestClip> clips = makeClips(config);
+        for (TestClip &clip : clips)
+        {
+            clip.expected = model.generate(clip.audio);
+        }
+
+        Failures failures;
+        testGenerate(model, clips, config, failures);
+        testCancellation(model, clips, config, failures);
+        testLongForm(model, clips, config, failures);
+
+        if (failures.count() > 0)
+        {
+            std::cerr << failures.count() << " failures\n";
+            return 1;
+        }
+        std::cout << "All concurrent results match the serial runs\n";
+    }
+    catch (const Ort::Exception &e)
+    {
+        std::cerr << "ONNX Runtime error: " << e.what() << "\n";
+        return 1;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
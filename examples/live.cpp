@@ -1,23 +1,49 @@
 // live.cpp
 #define SDL_MAIN_HANDLED
+#include <audio.hpp>
 #include <moonshine.hpp>
+#include <ring_buffer.hpp>
+#include <streaming.hpp>
 #include <SDL.h>
+#include <algorithm>
 #include <iostream>
+#include <string>
 #include <vector>
 #include <chrono>
 #include <thread>
 #include <atomic>
+#include <cstring>
+#include <functional>
+
+#ifdef _WIN32
 #include <conio.h>  // For _kbhit() and _getch() on Windows
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <sys/select.h>
+#include <termios.h>
+#include <unistd.h>
+#endif
 
 const int SAMPLE_RATE = 16000;
 const int BUFFER_SIZE = 4096;
+const size_t RING_CAPACITY = 1 << 20;        // About 65 seconds of audio
+const size_t FEED_CHUNK = SAMPLE_RATE / 10;  // 100 ms per write in file mode
+
+struct CaptureBuffer
+{
+    SpscRingBuffer<float> ring{RING_CAPACITY};  // Written by the capture side only
+    std::atomic<size_t> dropped{0};             // Samples lost because the ring was full
+};
 
 void audioCallback(void* userdata, Uint8* stream, int len)
 {
-    std::vector<float>* buffer = static_cast<std::vector<float>*>(userdata);
-    float* samples = reinterpret_cast<float*>(stream);
-    int sample_count = len / sizeof(float);
-    buffer->insert(buffer->end(), samples, samples + sample_count);
+    // Runs on SDL's audio thread, so it must not lock or allocate
+    CaptureBuffer* capture = static_cast<CaptureBuffer*>(userdata);
+    const float* samples = reinterpret_cast<const float*>(stream);
+    size_t sample_count = len / sizeof(float);
+    size_t written = capture->ring.write(samples, sample_count);
+    capture->dropped += sample_count - written;
 }
 
 void listAudioDevices()
@@ -31,16 +57,180 @@ void listAudioDevices()
     }
 }
 
+// Reads single key presses from the console without waiting for Enter
+class KeyboardInput
+{
+   public:
+    explicit KeyboardInput(bool enabled)
+    {
+#ifndef _WIN32
+        // Switch the terminal to non-canonical mode without echo while we own it
+        enabled_ = enabled && isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved_) == 0;
+        if (enabled_)
+        {
+            termios raw = saved_;
+            raw.c_lflag &= ~(ICANON | ECHO);
+            raw.c_cc[VMIN] = 0;
+            raw.c_cc[VTIME] = 0;
+            tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+        }
+#else
+        enabled_ = enabled;
+#endif
+    }
+
+    ~KeyboardInput()
+    {
+#ifndef _WIN32
+        if (enabled_)
+        {
+            tcsetattr(STDIN_FILENO, TCSANOW, &saved_);
+        }
+#endif
+    }
+
+    // Wait up to timeout_ms for a key press; returns the key, or -1 if there was none
+    int poll(int timeout_ms)
+    {
+        if (enabled_)
+        {
+#ifdef _WIN32
+            if (_kbhit())
+            {
+                return _getch();
+            }
+#else
+            fd_set fds;
+            FD_ZERO(&fds);
+            FD_SET(STDIN_FILENO, &fds);
+            timeval timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+            unsigned char ch = 0;
+            if (select(STDIN_FILENO + 1, &fds, nullptr, nullptr, &timeout) > 0 &&
+                read(STDIN_FILENO, &ch, 1) == 1)
+            {
+                return ch;
+            }
+            return -1;
+#endif
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+        return -1;
+    }
+
+   private:
+    bool enabled_ = false;
+#ifndef _WIN32
+    termios saved_{};
+#endif
+};
+
+// Write samples into the ring buffer and wait until they are due at speed times real time,
+// the way a microphone would deliver them
+void writePaced(CaptureBuffer& capture, const float* samples, size_t count, double speed,
+                std::chrono::steady_clock::time_point& next_chunk)
+{
+    size_t written = capture.ring.write(samples, count);
+    capture.dropped += count - written;
+
+    next_chunk += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(count / (SAMPLE_RATE * speed)));
+    std::this_thread::sleep_until(next_chunk);
+}
+
+// Feed a decoded file, already resampled to 16 kHz mono
+void feedFile(const std::vector<float>& audio, CaptureBuffer& capture, double speed,
+              std::atomic<bool>& capturing)
+{
+    auto next_chunk = std::chrono::steady_clock::now();
+    for (size_t offset = 0; capturing && offset < audio.size(); offset += FEED_CHUNK)
+    {
+        writePaced(capture, audio.data() + offset, std::min(FEED_CHUNK, audio.size() - offset),
+                   speed, next_chunk);
+    }
+    capturing = false;
+}
+
+// Feed 16-bit mono 16 kHz PCM from a WAV or raw stream as it arrives
+void feedStream(std::istream& input, CaptureBuffer& capture, double speed,
+                std::atomic<bool>& capturing)
+{
+    std::vector<int16_t> pcm(FEED_CHUNK);
+    std::vector<float> samples(FEED_CHUNK);
+
+    // Skip the header of WAV input; anything else is taken as raw PCM
+    char header[44];
+    input.read(header, sizeof(header));
+    size_t header_samples = 0;
+    if (input.gcount() < 4 || std::strncmp(header, "RIFF", 4) != 0)
+    {
+        header_samples = static_cast<size_t>(input.gcount()) / sizeof(int16_t);
+        std::memcpy(pcm.data(), header, header_samples * sizeof(int16_t));
+    }
+
+    auto next_chunk = std::chrono::steady_clock::now();
+    while (capturing)
+    {
+        input.read(reinterpret_cast<char*>(pcm.data() + header_samples),
+                   (pcm.size() - header_samples) * sizeof(int16_t));
+        size_t count = header_samples + static_cast<size_t>(input.gcount()) / sizeof(int16_t);
+        header_samples = 0;
+        if (count == 0)
+        {
+            break;
+        }
+
+        int16ToFloat(pcm.data(), count, samples.data());
+        writePaced(capture, samples.data(), count, speed, next_chunk);
+    }
+    capturing = false;
+}
+
+void printUsage(const char* program)
+{
+    std::cerr << "Usage: " << program << " <models_dir> [--file <wav_file>|-] [--speed <x>]\n"
+              << "  --file <wav_file>  Feed a WAV file instead of the microphone, resampled to\n"
+              << "                     16 kHz mono; '-' reads 16 kHz mono 16-bit WAV or raw\n"
+              << "                     PCM from stdin\n"
+              << "  --speed <x>        Feed the file at x times real time (default 1)\n";
+}
+
 int main(int argc, char* argv[])
 {
     std::cout << "Moonshine Live Transcription\n";
 
     SDL_SetMainReady();  // Tell SDL we'll handle the main entry point
-    if (argc != 2)
+    if (argc < 2)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::string input_file;
+    double speed = 1.0;
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--file" && i + 1 < argc)
+        {
+            input_file = argv[++i];
+        }
+        else if (arg == "--speed" && i + 1 < argc)
+        {
+            speed = std::stod(argv[++i]);
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (speed <= 0.0)
     {
-        std::cerr << "Usage: " << argv[0] << " <models_dir>\n";
+        std::cerr << "Speed must be positive\n";
         return 1;
     }
+    const bool use_microphone = input_file.empty();
+    const bool use_stdin = input_file == "-";
 
     try
     {
@@ -51,128 +241,157 @@ int main(int argc, char* argv[])
 
         std::cout << "Model initialized\n";
 
-        // Initialize SDL
-        if (SDL_Init(SDL_INIT_AUDIO) < 0)
+        CaptureBuffer capture;
+        std::atomic<bool> capturing(true);
+        SDL_AudioDeviceID dev = 0;
+        std::vector<float> file_audio;
+        std::thread feeder_thread;
+
+        if (use_microphone)
         {
-            std::cerr << "Could not initialize SDL: " << SDL_GetError() << "\n";
-            return 1;
-        }
+            // Initialize SDL
+            if (SDL_Init(SDL_INIT_AUDIO) < 0)
+            {
+                std::cerr << "Could not initialize SDL: " << SDL_GetError() << "\n";
+                return 1;
+            }
+
+            std::cout << "SDL initialized\n";
 
-        std::cout << "SDL initialized\n";
+            // List available devices
+            listAudioDevices();
 
-        // List available devices
-        listAudioDevices();
+            // Set up audio capture
+            SDL_AudioSpec desired_spec;
+            SDL_AudioSpec obtained_spec;
+            SDL_zero(desired_spec);
+            desired_spec.freq = SAMPLE_RATE;
+            desired_spec.format = AUDIO_F32;
+            desired_spec.channels = 1;
+            desired_spec.samples = BUFFER_SIZE;
+            desired_spec.callback = audioCallback;
+            desired_spec.userdata = &capture;
 
-        // Set up audio capture
-        SDL_AudioSpec desired_spec;
-        SDL_AudioSpec obtained_spec;
-        SDL_zero(desired_spec);
-        desired_spec.freq = SAMPLE_RATE;
-        desired_spec.format = AUDIO_F32;
-        desired_spec.channels = 1;
-        desired_spec.samples = BUFFER_SIZE;
-        desired_spec.callback = audioCallback;
+            // Open the default recording device. SDL converts to the desired spec, which the
+            // callback relies on.
+            dev = SDL_OpenAudioDevice(NULL,            // device name (NULL for default)
+                                      SDL_TRUE,        // is_capture (recording)
+                                      &desired_spec,   // desired spec
+                                      &obtained_spec,  // obtained spec
+                                      0);              // no format changes
 
-        std::vector<float> audio_buffer;
-        desired_spec.userdata = &audio_buffer;
+            if (dev == 0)
+            {
+                std::cerr << "Could not open audio device: " << SDL_GetError() << "\n";
+                SDL_Quit();
+                return 1;
+            }
 
-        // Open the default recording device
-        SDL_AudioDeviceID dev = SDL_OpenAudioDevice(NULL,      // device name (NULL for default)
-                                                    SDL_TRUE,  // is_capture (recording)
-                                                    &desired_spec,   // desired spec
-                                                    &obtained_spec,  // obtained spec
-                                                    SDL_AUDIO_ALLOW_FORMAT_CHANGE);
+            std::cout << "Audio device opened: " << SDL_GetAudioDeviceName(0, SDL_TRUE) << "\n";
+            // print the obtained spec
+            std::cout << "Obtained spec: " << obtained_spec.freq << " Hz, "
+                      << SDL_AUDIO_BITSIZE(obtained_spec.format) << " bits, "
+                      << (obtained_spec.channels == 1 ? "mono" : "stereo") << "\n";
 
-        if (dev == 0)
+            // Start audio capture
+            SDL_PauseAudioDevice(dev, 0);
+        }
+        else
         {
-            std::cerr << "Could not open audio device: " << SDL_GetError() << "\n";
-            SDL_Quit();
-            return 1;
+            std::cout << "Feeding " << (use_stdin ? "stdin" : input_file) << " at " << speed
+                      << "x real time\n";
+            if (use_stdin)
+            {
+#ifdef _WIN32
+                _setmode(_fileno(stdin), _O_BINARY);
+#endif
+                feeder_thread = std::thread(feedStream, std::ref(std::cin), std::ref(capture),
+                                            speed, std::ref(capturing));
+            }
+            else
+            {
+                file_audio = loadAudio(input_file);
+                feeder_thread = std::thread(feedFile, std::cref(file_audio), std::ref(capture),
+                                            speed, std::ref(capturing));
+            }
         }
 
-        std::cout << "Audio device opened: " << SDL_GetAudioDeviceName(0, SDL_TRUE) << "\n";
-        // print the obtained spec
-        std::cout << "Obtained spec: " << obtained_spec.freq << " Hz, "
-                  << SDL_AUDIO_BITSIZE(obtained_spec.format) << " bits, "
-                  << (obtained_spec.channels == 1 ? "mono" : "stereo") << "\n";
-
-        // Start audio capture
-        SDL_PauseAudioDevice(dev, 0);
-
-        std::atomic<bool> running(true);
         std::thread transcription_thread(
             [&]()
             {
                 std::cout << "Transcribing...\n";
-                size_t last_buffer_size = 0;
-                while (running)
-                {
-                    if (audio_buffer.size() >= SAMPLE_RATE)
+
+                // Partial results overwrite the current console line, final ones end it
+                StreamingTranscriber transcriber(
+                    model,
+                    [](const StreamingResult& result)
                     {
-                        if (audio_buffer.size() == last_buffer_size)
-                        {
-                            // No new audio data
-                            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                            continue;
-                        }
-                        last_buffer_size = audio_buffer.size();
-
-                        // Process audio buffer
-                        std::vector<float> buffer(audio_buffer.begin(), audio_buffer.end());
-
-                        // Limit the buffer size to 10 seconds
-                        if (audio_buffer.size() > 10 * SAMPLE_RATE)
-                        {
-                            audio_buffer.erase(audio_buffer.begin(), audio_buffer.end());
-                        }
-
-                        // Generate tokens
-                        auto start = std::chrono::high_resolution_clock::now();
-                        auto tokens = model.generate(buffer);
-                        auto end = std::chrono::high_resolution_clock::now();
-                        std::chrono::duration<double> duration = end - start;
-
-                        // Detokenize tokens
-                        std::string result = model.detokenize(tokens);
-
-                        // erase the last console line
-                        std::cout << "\x1b[A";
                         // clear the line
                         std::cout << "\r\033[K";
+                        std::cout << "Transcription: " << result.text;
+                        std::cout << (result.is_final ? "\n" : "") << std::flush;
+                    });
 
-                        std::cout << "Transcription: " << result << "\n";
+                // Drain the ring buffer until capture has stopped and nothing is left
+                std::vector<float> buffer(BUFFER_SIZE);
+                while (true)
+                {
+                    size_t count = capture.ring.read(buffer.data(), buffer.size());
+                    if (count > 0)
+                    {
+                        transcriber.push(buffer.data(), count);
+                        continue;
                     }
-                    else
+                    if (!capturing && capture.ring.size() == 0)
                     {
-                        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                        break;
                     }
+                    // No new audio data
+                    std::this_thread::sleep_for(std::chrono::milliseconds(20));
                 }
+                transcriber.flush();
                 std::cout << "Transcription thread finished\n";
             });
 
-        std::cout << "Recording... Press 'q' or 'ESC' to stop.\n";
-        while (running)
         {
-            if (_kbhit())
+            // stdin carries the audio in stdin mode, so keys are only read otherwise
+            KeyboardInput keyboard(!use_stdin);
+            std::cout << "Recording... Press 'q' or 'ESC' to stop.\n";
+            while (capturing)
             {
-                int ch = _getch();
+                int ch = keyboard.poll(100);
                 if (ch == 'q' || ch == 27)
                 {  // 27 is the ASCII code for ESC
-                    running = false;
+                    capturing = false;
                 }
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
         }
 
-        // Stop audio capture
-        SDL_PauseAudioDevice(dev, 1);
+        if (use_microphone)
+        {
+            // Stop audio capture
+            SDL_PauseAudioDevice(dev, 1);
+        }
+        else
+        {
+            feeder_thread.join();
+        }
 
         // Wait for transcription thread to finish
         transcription_thread.join();
 
+        if (capture.dropped > 0)
+        {
+            std::cerr << "Dropped " << capture.dropped << " samples because transcription fell "
+                      << "behind capture\n";
+        }
+
         // Clean up
-        SDL_CloseAudioDevice(dev);
-        SDL_Quit();
+        if (use_microphone)
+        {
+            SDL_CloseAudioDevice(dev);
+            SDL_Quit();
+        }
     }
     catch (const Ort::Exception& e)
     {
@@ -186,4 +405,4 @@ int main(int argc, char* argv[])
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,754 @@
+// server.cpp
+#include <audio.hpp>
+#include <moonshine.hpp>
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+using Socket = SOCKET;
+const Socket NO_SOCKET = INVALID_SOCKET;
+void closeSocket(Socket socket)
+{
+    closesocket(socket);
+}
+#else
+using Socket = int;
+const Socket NO_SOCKET = -1;
+void closeSocket(Socket socket)
+{
+    close(socket);
+}
+#endif
+
+const int SAMPLE_RATE = 16000;
+const size_t MAX_HEADER_BYTES = 16 * 1024;
+const size_t MAX_BODY_BYTES = 256 * 1024 * 1024;
+const size_t LATENCY_WINDOW = 1024;  // Recent requests the latency quantiles are taken over
+
+struct ServerConfig
+{
+    std::string models_dir;           ///< Directory of the ONNX models.
+    std::string socket_path;          ///< Unix domain socket to listen on, instead of TCP.
+    int port = 8090;                  ///< Localhost TCP port, when no socket path is given.
+    int threads = 1;                  ///< Intra-op threads per session.
+    size_t workers = 1;               ///< Batches decoded concurrently.
+    size_t max_batch = 8;             ///< Most requests decoded together.
+    double batch_wait_ms = 10.0;      ///< Longest a request waits for others to join it.
+    double max_length_ratio = 1.5;    ///< Longest to shortest clip allowed in one batch.
+    /// Longer clips are chunked by transcribe_long() and never batched.
+    double long_form_seconds = LongFormOptions().chunk_seconds;
+};
+
+std::atomic<bool> stopping(false);
+
+void onSignal(int)
+{
+    stopping = true;
+}
+
+// Latency and throughput figures, rendered in the Prometheus text format
+class Metrics
+{
+   public:
+    void recordRequest(double queue_seconds, double total_seconds, double audio_seconds)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++requests_;
+        audio_seconds_ += audio_seconds;
+        total_seconds_ += total_seconds;
+        queue_seconds_ += queue_seconds;
+        if (latencies_.size() < LATENCY_WINDOW)
+        {
+            latencies_.push_back(total_seconds);
+            queue_latencies_.push_back(queue_seconds);
+        }
+        else
+        {
+            latencies_[next_] = total_seconds;
+            queue_latencies_[next_] = queue_seconds;
+            next_ = (next_ + 1) % LATENCY_WINDOW;
+        }
+    }
+
+    void recordFailure()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++failures_;
+    }
+
+    void recordBatch(size_t size, double seconds)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++batches_;
+        batched_requests_ += size;
+        inference_seconds_ += seconds;
+    }
+
+    std::string render(size_t queue_depth) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::ostringstream out;
+        auto metric = [&out](const char *name, const char *type, const char *help, double value)
+        {
+            out << "# HELP " << name << " " << help << "\n"
+                << "# TYPE " << name << " " << type << "\n"
+                << name << " " << value << "\n";
+        };
+        auto summary = [&out](const char *name, const char *help, std::vector<double> values,
+                              double sum, size_t count)
+        {
+            std::sort(values.begin(), values.end());
+            out << "# HELP " << name << " " << help << "\n"
+                << "# TYPE " << name << " summary\n";
+            for (double quantile : {0.5, 0.95, 0.99})
+            {
+                const size_t index = static_cast<size_t>(quantile * values.size());
+                const double value =
+                    values.empty() ? 0.0 : values[std::min(values.size() - 1, index)];
+                out << name << "{quantile=\"" << quantile << "\"} " << value << "\n";
+            }
+            out << name << "_sum " << sum << "\n" << name << "_count " << count << "\n";
+        };
+
+        metric("moonshine_queue_depth", "gauge", "Requests waiting to be batched.",
+               static_cast<double>(queue_depth));
+        metric("moonshine_requests_total", "counter", "Requests transcribed.",
+               static_cast<double>(requests_));
+        metric("moonshine_request_failures_total", "counter", "Requests that failed.",
+               static_cast<double>(failures_));
+        metric("moonshine_batches_total", "counter", "Batches decoded.",
+               static_cast<double>(batches_));
+        metric("moonshine_batched_requests_total", "counter",
+               "Requests decoded in batches; divided by batches, the mean batch size.",
+               static_cast<double>(batched_requests_));
+        metric("moonshine_audio_seconds_total", "counter", "Seconds of audio transcribed.",
+               audio_seconds_);
+        metric("moonshine_inference_seconds_total", "counter", "Wall time spent decoding.",
+               inference_seconds_);
+        summary("moonshine_request_latency_seconds",
+                "Time from queueing to result over recent requests.", latencies_, total_seconds_,
+                requests_);
+        summary("moonshine_queue_latency_seconds",
+                "Time requests waited for a batch over recent requests.", queue_latencies_,
+                queue_seconds_, requests_);
+        return out.str();
+    }
+
+   private:
+    mutable std::mutex mutex_;
+    size_t requests_ = 0;
+    size_t failures_ = 0;
+    size_t batches_ = 0;
+    size_t batched_requests_ = 0;
+    double audio_seconds_ = 0.0;
+    double total_seconds_ = 0.0;
+    double queue_seconds_ = 0.0;
+    double inference_seconds_ = 0.0;
+    std::vector<double> latencies_;
+    std::vector<double> queue_latencies_;
+    size_t next_ = 0;
+};
+
+struct Transcript
+{
+    std::vector<int32_t> tokens;
+    double queue_seconds = 0.0;      ///< Time spent waiting for a batch.
+    double inference_seconds = 0.0;  ///< Wall time of the batch it was decoded in.
+    size_t batch_size = 0;           ///< Requests decoded together with it, itself included.
+};
+
+// Groups concurrent requests into batches within a latency budget and decodes them
+class Batcher
+{
+   public:
+    Batcher(MoonshineModel &model, const ServerConfig &config, Metrics &metrics)
+        : model_(model), config_(config), metrics_(metrics)
+    {
+        for (size_t i = 0; i < std::max<size_t>(1, config_.workers); ++i)
+        {
+            workers_.emplace_back(&Batcher::run, this);
+        }
+    }
+
+    ~Batcher()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        ready_.notify_all();
+        for (auto &worker : workers_)
+        {
+            worker.join();
+        }
+    }
+
+    std::future<Transcript> submit(std::vector<float> audio)
+    {
+        auto request = std::make_unique<Request>();
+        request->audio = std::move(audio);
+        request->queued = std::chrono::steady_clock::now();
+        std::future<Transcript> result = request->promise.get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(std::move(request));
+        }
+        ready_.notify_one();
+        return result;
+    }
+
+    size_t depth() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return queue_.size();
+    }
+
+   private:
+    struct Request
+    {
+        std::vector<float> audio;
+        std::chrono::steady_clock::time_point queued;
+        std::promise<Transcript> promise;
+    };
+
+    bool isLong(const Request &request) const
+    {
+        return request.audio.size() > config_.long_form_seconds * SAMPLE_RATE;
+    }
+
+    // Wait for the oldest request, give others until its budget runs out to arrive, then take
+    // it with the queued requests of similar length. Padding every clip to the longest one
+    // is what batching costs, so dissimilar clips wait for a later batch instead.
+    std::vector<std::unique_ptr<Request>> nextBatch()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        const auto budget = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double, std::milli>(config_.batch_wait_ms));
+        while (true)
+        {
+            ready_.wait(lock, [this] { return closed_ || !queue_.empty(); });
+            if (queue_.empty())
+            {
+                return {};
+            }
+            ready_.wait_until(lock, queue_.front()->queued + budget,
+                              [this] { return closed_ || queue_.size() >= config_.max_batch; });
+
+            // Other workers may have emptied the queue while the lock was released; the
+            // budget is then taken from whichever request is oldest by the next round
+            if (!queue_.empty())
+            {
+                break;
+            }
+        }
+
+        std::vector<std::unique_ptr<Request>> batch;
+        batch.push_back(std::move(queue_.front()));
+        queue_.pop_front();
+        if (isLong(*batch[0]))
+        {
+            return batch;
+        }
+        const double base = static_cast<double>(std::max<size_t>(1, batch[0]->audio.size()));
+        for (auto it = queue_.begin(); it != queue_.end() && batch.size() < config_.max_batch;)
+        {
+            const double length = static_cast<double>(std::max<size_t>(1, (*it)->audio.size()));
+            if (!isLong(**it) && std::max(length, base) / std::min(length, base) <=
+                                     config_.max_length_ratio)
+            {
+                batch.push_back(std::move(*it));
+                it = queue_.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+        return batch;
+    }
+
+    void run()
+    {
+        while (true)
+        {
+            std::vector<std::unique_ptr<Request>> batch = nextBatch();
+            if (batch.empty())
+            {
+                return;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            try
+            {
+                std::vector<std::vector<int32_t>> tokens;
+                if (batch.size() == 1)
+                {
+                    tokens.push_back(model_.transcribe_long(batch[0]->audio));
+                }
+                else
+                {
+                    std::vector<std::vector<float>> audio_batch;
+                    for (auto &request : batch)
+                    {
+                        audio_batch.push_back(std::move(request->audio));
+                    }
+                    tokens = model_.generate_batch(audio_batch);
+                }
+
+                const auto end = std::chrono::steady_clock::now();
+                const double inference = std::chrono::duration<double>(end - start).count();
+                metrics_.recordBatch(batch.size(), inference);
+                for (size_t i = 0; i < batch.size(); ++i)
+                {
+                    Transcript transcript;
+                    transcript.tokens = std::move(tokens[i]);
+                    transcript.queue_seconds =
+                        std::chrono::duration<double>(start - batch[i]->queued).count();
+                    transcript.inference_seconds = inference;
+                    transcript.batch_size = batch.size();
+                    batch[i]->promise.set_value(std::move(transcript));
+                }
+            }
+            catch (...)
+            {
+                for (auto &request : batch)
+                {
+                    request->promise.set_exception(std::current_exception());
+                }
+            }
+        }
+    }
+
+    MoonshineModel &model_;
+    const ServerConfig &config_;
+    Metrics &metrics_;
+    mutable std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<std::unique_ptr<Request>> queue_;
+    bool closed_ = false;
+    std::vector<std::thread> workers_;
+};
+
+struct HttpRequest
+{
+    std::string method;
+    std::string path;
+    std::string body;
+};
+
+bool sendAll(Socket socket, const std::string &data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        const int count = send(socket, data.data() + sent, static_cast<int>(data.size() - sent), 0);
+        if (count <= 0)
+        {
+            return false;
+        }
+        sent += static_cast<size_t>(count);
+    }
+    return true;
+}
+
+void sendResponse(Socket socket, int status, const std::string &content_type,
+                  const std::string &body)
+{
+    const char *reason = status == 200   ? "OK"
+                         : status == 400 ? "Bad Request"
+                         : status == 404 ? "Not Found"
+                         : status == 413 ? "Payload Too Large"
+                                         : "Internal Server Error";
+    std::ostringstream response;
+    response << "HTTP/1.1 " << status << " " << reason << "\r\n"
+             << "Content-Type: " << content_type << "\r\n"
+             << "Content-Length: " << body.size() << "\r\n"
+             << "Connection: close\r\n\r\n"
+             << body;
+    sendAll(socket, response.str());
+}
+
+void sendError(Socket socket, int status, const std::string &message)
+{
+    sendResponse(socket, status, "application/json",
+                 nlohmann::json({{"error", message}}).dump() + "\n");
+}
+
+// Read one request; returns the HTTP status to fail with, or 200
+int readRequest(Socket socket, HttpRequest &request)
+{
+    std::string data;
+    size_t header_end = std::string::npos;
+    char buffer[64 * 1024];
+    while (header_end == std::string::npos)
+    {
+        const int count = recv(socket, buffer, sizeof(buffer), 0);
+        if (count <= 0)
+        {
+            return 400;
+        }
+        data.append(buffer, static_cast<size_t>(count));
+        header_end = data.find("\r\n\r\n");
+        if (header_end == std::string::npos && data.size() > MAX_HEADER_BYTES)
+        {
+            return 400;
+        }
+    }
+
+    std::istringstream headers(data.substr(0, header_end));
+    std::string line;
+    std::getline(headers, line);
+    std::istringstream request_line(line);
+    request_line >> request.method >> request.path;
+    size_t content_length = 0;
+    bool expect_continue = false;
+    while (std::getline(headers, line))
+    {
+        std::string lower = line;
+        std::transform(lower.begin(), lower.end(), lower.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        if (lower.rfind("content-length:", 0) == 0)
+        {
+            const char *begin = line.data() + 15;
+            const char *end = line.data() + line.size();
+            while (begin < end && (*begin == ' ' || *begin == '\t'))
+            {
+                ++begin;
+            }
+            while (end > begin && std::isspace(static_cast<unsigned char>(end[-1])))
+            {
+                --end;
+            }
+            const auto [rest, error] = std::from_chars(begin, end, content_length);
+            if (error != std::errc() || rest != end || begin == end)
+            {
+                return 400;
+            }
+        }
+        else if (lower.rfind("expect:", 0) == 0 && lower.find("100-continue") != std::string::npos)
+        {
+            expect_continue = true;
+        }
+    }
+    if (content_length > MAX_BODY_BYTES)
+    {
+        return 413;
+    }
+    if (expect_continue)
+    {
+        sendAll(socket, "HTTP/1.1 100 Continue\r\n\r\n");
+    }
+
+    request.body = data.substr(header_end + 4);
+    while (request.body.size() < content_length)
+    {
+        const int count = recv(socket, buffer, sizeof(buffer), 0);
+        if (count <= 0)
+        {
+            return 400;
+        }
+        request.body.append(buffer, static_cast<size_t>(count));
+    }
+    request.body.resize(content_length);
+    return 200;
+}
+
+void handleClient(Socket socket, MoonshineModel &model, Batcher &batcher, Metrics &metrics)
+{
+    HttpRequest request;
+    const int status = readRequest(socket, request);
+    if (status != 200)
+    {
+        sendError(socket, status, "Malformed request");
+    }
+    else if (request.method == "GET" && request.path == "/health")
+    {
+        sendResponse(socket, 200, "text/plain", "ok\n");
+    }
+    else if (request.method == "GET" && request.path == "/metrics")
+    {
+        sendResponse(socket, 200, "text/plain; version=0.0.4", metrics.render(batcher.depth()));
+    }
+    else if (request.method == "POST" && request.path == "/transcribe")
+    {
+        const auto start = std::chrono::steady_clock::now();
+        try
+        {
+            // The body is a WAV file in any supported format, or raw 16 kHz mono 16-bit PCM
+            AudioFile file(std::vector<uint8_t>(request.body.begin(), request.body.end()));
+            std::vector<float> audio = file.decode();
+            const double audio_seconds = static_cast<double>(audio.size()) / SAMPLE_RATE;
+
+            Transcript transcript = batcher.submit(std::move(audio)).get();
+            const double total =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            metrics.recordRequest(transcript.queue_seconds, total, audio_seconds);
+
+            nlohmann::json result;
+            result["text"] = model.detokenize(transcript.tokens);
+            result["tokens"] = transcript.tokens;
+            result["audio_seconds"] = audio_seconds;
+            result["queue_seconds"] = transcript.queue_seconds;
+            result["inference_seconds"] = transcript.inference_seconds;
+            result["batch_size"] = transcript.batch_size;
+            sendResponse(socket, 200, "application/json", result.dump() + "\n");
+        }
+        catch (const std::exception &e)
+        {
+            metrics.recordFailure();
+            sendError(socket, 500, e.what());
+        }
+    }
+    else
+    {
+        sendError(socket, 404, "Unknown endpoint; use POST /transcribe, GET /metrics or "
+                               "GET /health");
+    }
+    closeSocket(socket);
+}
+
+Socket listenOn(const ServerConfig &config)
+{
+    Socket listener = NO_SOCKET;
+    if (!config.socket_path.empty())
+    {
+#ifdef _WIN32
+        throw std::runtime_error("Unix domain sockets are not supported on Windows; use --port");
+#else
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (config.socket_path.size() >= sizeof(address.sun_path))
+        {
+            throw std::runtime_error("Socket path is too long: " + config.socket_path);
+        }
+        std::strncpy(address.sun_path, config.socket_path.c_str(), sizeof(address.sun_path) - 1);
+        unlink(config.socket_path.c_str());
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener == NO_SOCKET ||
+            bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+        {
+            throw std::runtime_error("Could not bind socket: " + config.socket_path);
+        }
+#endif
+    }
+    else
+    {
+        // Only the loopback interface; the server has no authentication
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(static_cast<uint16_t>(config.port));
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        if (listener != NO_SOCKET)
+        {
+            setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&reuse),
+                       sizeof(reuse));
+        }
+        if (listener == NO_SOCKET ||
+            bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+        {
+            throw std::runtime_error("Could not bind 127.0.0.1:" + std::to_string(config.port));
+        }
+    }
+    if (listen(listener, SOMAXCONN) != 0)
+    {
+        closeSocket(listener);
+        throw std::runtime_error("Could not listen for connections");
+    }
+    return listener;
+}
+
+void printUsage(const char *program)
+{
+    std::cerr << "Usage: " << program << " <models_dir> [options]\n"
+              << "  --socket <path>       Listen on a Unix domain socket instead of TCP\n"
+              << "  --port <n>            Localhost TCP port (default 8090)\n"
+              << "  --threads <n>         Intra-op threads per session (default 1)\n"
+              << "  --workers <n>         Batches decoded concurrently (default 1)\n"
+              << "  --max-batch <n>       Most requests decoded together (default 8)\n"
+              << "  --batch-wait-ms <ms>  Longest a request waits for a batch (default 10)\n"
+              << "  --max-length-ratio <x>  Longest to shortest clip in a batch (default 1.5)\n";
+}
+
+ServerConfig parseArgs(int argc, char *argv[])
+{
+    ServerConfig config;
+    config.models_dir = argv[1];
+    for (int i = 2; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc)
+        {
+            throw std::runtime_error("Missing value for " + arg);
+        }
+        const std::string value = argv[++i];
+        if (arg == "--socket")
+        {
+            config.socket_path = value;
+        }
+        else if (arg == "--port")
+        {
+            config.port = std::stoi(value);
+        }
+        else if (arg == "--threads")
+        {
+            config.threads = std::stoi(value);
+        }
+        else if (arg == "--workers")
+        {
+            config.workers = std::max<size_t>(1, std::stoul(value));
+        }
+        else if (arg == "--max-batch")
+        {
+            config.max_batch = std::max<size_t>(1, std::stoul(value));
+        }
+        else if (arg == "--batch-wait-ms")
+        {
+            config.batch_wait_ms = std::stod(value);
+        }
+        else if (arg == "--max-length-ratio")
+        {
+            config.max_length_ratio = std::max(1.0, std::stod(value));
+        }
+        else
+        {
+            throw std::runtime_error("Unknown option: " + arg);
+        }
+    }
+    return config;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+#ifdef _WIN32
+    WSADATA wsa_data;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+    {
+        std::cerr << "Could not initialize Winsock\n";
+        return 1;
+    }
+#else
+    // A client hanging up mid-response must not kill the server
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    try
+    {
+        ServerConfig config = parseArgs(argc, argv);
+
+        RuntimeOptions options;
+        options.intra_op_num_threads = config.threads;
+        MoonshineModel model(config.models_dir, options);
+
+        Metrics metrics;
+        Batcher batcher(model, config, metrics);
+        Socket listener = listenOn(config);
+        std::cout << "Listening on "
+                  << (config.socket_path.empty() ? "http://127.0.0.1:" + std::to_string(config.port)
+                                                 : config.socket_path)
+                  << "\n";
+
+        // Poll so that a signal can stop the loop; every connection gets its own thread,
+        // which only parses HTTP and waits for its batch
+        std::atomic<size_t> connections(0);
+        while (!stopping)
+        {
+            fd_set fds;
+            FD_ZERO(&fds);
+            FD_SET(listener, &fds);
+            timeval timeout = {0, 200 * 1000};
+            if (select(static_cast<int>(listener) + 1, &fds, nullptr, nullptr, &timeout) <= 0)
+            {
+                continue;
+            }
+            Socket client = accept(listener, nullptr, nullptr);
+            if (client == NO_SOCKET)
+            {
+                continue;
+            }
+            ++connections;
+            std::thread(
+                [client, &model, &batcher, &metrics, &connections]
+                {
+                    // Nothing a client sends may take the server down with it
+                    try
+                    {
+                        handleClient(client, model, batcher, metrics);
+                    }
+                    catch (const std::exception &e)
+                    {
+                        std::cerr << "Connection failed: " << e.what() << "\n";
+                        closeSocket(client);
+                    }
+                    --connections;
+                })
+                .detach();
+        }
+
+        std::cout << "Shutting down\n";
+        closeSocket(listener);
+        while (connections > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+#ifndef _WIN32
+        if (!config.socket_path.empty())
+        {
+            unlink(config.socket_path.c_str());
+        }
+#endif
+    }
+    catch (const Ort::Exception &e)
+    {
+        std::cerr << "ONNX Runtime error: " << e.what() << "\n";
+        return 1;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return 0;
+}
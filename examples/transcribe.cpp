@@ -0,0 +1,397 @@
+// transcribe.cpp
+#include <audio.hpp>
+#include <moonshine.hpp>
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+const int SAMPLE_RATE = 16000;
+
+struct TranscribeConfig
+{
+    std::string models_dir;           ///< Directory of the ONNX models.
+    std::vector<std::string> inputs;  ///< Files, directories and manifests, in order.
+    std::string output;               ///< JSONL output file; stdout if empty.
+    int threads = 1;                  ///< Intra-op threads per session.
+    size_t workers = 0;               ///< Files transcribed at once; 0 fits the cores.
+    size_t decoders = 1;              ///< Threads decoding audio ahead of the workers.
+    size_t prefetch = 0;              ///< Decoded files kept ready; 0 is twice the workers.
+};
+
+// A decoded file waiting for a worker
+struct DecodedFile
+{
+    size_t index = 0;
+    std::string path;
+    std::vector<float> audio;
+    std::string error;  // Set instead of audio when the file could not be decoded
+    double decode_seconds = 0.0;
+    std::chrono::steady_clock::time_point decoded;
+};
+
+// Bounded queue between the decoding threads and the workers; pop() returns false once every
+// file has been taken
+class PrefetchQueue
+{
+   public:
+    PrefetchQueue(size_t capacity, size_t producers) : capacity_(capacity), producers_(producers)
+    {
+    }
+
+    void push(DecodedFile file)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return queue_.size() < capacity_; });
+        queue_.push_back(std::move(file));
+        not_empty_.notify_one();
+    }
+
+    void producerDone()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --producers_;
+        not_empty_.notify_all();
+    }
+
+    bool pop(DecodedFile &file)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return !queue_.empty() || producers_ == 0; });
+        if (queue_.empty())
+        {
+            return false;
+        }
+        file = std::move(queue_.front());
+        queue_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+   private:
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+    std::deque<DecodedFile> queue_;
+    size_t capacity_;
+    size_t producers_;
+};
+
+bool isWav(const fs::path &path)
+{
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return extension == ".wav";
+}
+
+void addPath(const std::string &path, std::vector<std::string> &files)
+{
+    if (fs::is_directory(path))
+    {
+        // Sorted, so that the indices of a directory are the same on every run
+        std::vector<std::string> found;
+        for (const auto &entry : fs::recursive_directory_iterator(path))
+        {
+            if (entry.is_regular_file() && isWav(entry.path()))
+            {
+                found.push_back(entry.path().string());
+            }
+        }
+        std::sort(found.begin(), found.end());
+        files.insert(files.end(), found.begin(), found.end());
+    }
+    else
+    {
+        files.push_back(path);
+    }
+}
+
+// One path per line; blank lines and lines starting with # are skipped
+void addManifest(std::istream &manifest, std::vector<std::string> &files)
+{
+    std::string line;
+    while (std::getline(manifest, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        if (!line.empty() && line[0] != '#')
+        {
+            addPath(line, files);
+        }
+    }
+}
+
+std::vector<std::string> collectFiles(const TranscribeConfig &config)
+{
+    std::vector<std::string> files;
+    for (const std::string &input : config.inputs)
+    {
+        if (input == "-")
+        {
+            addManifest(std::cin, files);
+        }
+        else if (input.size() > 1 && input[0] == '@')
+        {
+            std::ifstream manifest(input.substr(1));
+            if (!manifest)
+            {
+                throw std::runtime_error("Could not open manifest: " + input.substr(1));
+            }
+            addManifest(manifest, files);
+        }
+        else
+        {
+            addPath(input, files);
+        }
+    }
+    return files;
+}
+
+// Transcribe one decoded file into its JSONL record
+nlohmann::json transcribeFile(MoonshineModel &model, const DecodedFile &file,
+                              const LongFormOptions &long_form)
+{
+    nlohmann::json result;
+    result["index"] = file.index;
+    result["file"] = file.path;
+    if (!file.error.empty())
+    {
+        result["error"] = file.error;
+        return result;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    try
+    {
+        std::vector<int32_t> tokens = model.transcribe_long(file.audio, long_form);
+        const auto end = std::chrono::steady_clock::now();
+        const double inference = std::chrono::duration<double>(end - start).count();
+        const double audio_seconds = static_cast<double>(file.audio.size()) / SAMPLE_RATE;
+        result["text"] = model.detokenize(tokens);
+        result["tokens"] = tokens.size();
+        result["audio_seconds"] = audio_seconds;
+        result["decode_seconds"] = file.decode_seconds;
+        result["wait_seconds"] = std::chrono::duration<double>(start - file.decoded).count();
+        result["inference_seconds"] = inference;
+        result["rtf"] = audio_seconds > 0 ? inference / audio_seconds : 0.0;
+    }
+    catch (const std::exception &e)
+    {
+        result["error"] = e.what();
+    }
+    return result;
+}
+
+void printUsage(const char *program)
+{
+    std::cerr << "Usage: " << program << " <models_dir> <input>... [options]\n"
+              << "  An input is a WAV file, a directory searched for WAV files, @<manifest>\n"
+              << "  with one path per line, or - to read such a manifest from stdin.\n"
+              << "  --output <file>   Write JSONL results to a file instead of stdout\n"
+              << "  --workers <n>     Files transcribed at once (default: cores / threads)\n"
+              << "  --threads <n>     Intra-op threads per session (default 1)\n"
+              << "  --decoders <n>    Threads decoding audio ahead of inference (default 1)\n"
+              << "  --prefetch <n>    Decoded files kept ready (default: 2 x workers)\n";
+}
+
+TranscribeConfig parseArgs(int argc, char *argv[])
+{
+    TranscribeConfig config;
+    config.models_dir = argv[1];
+    for (int i = 2; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg.rfind("--", 0) != 0)
+        {
+            config.inputs.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            throw std::runtime_error("Missing value for " + arg);
+        }
+        const std::string value = argv[++i];
+        if (arg == "--output")
+        {
+            config.output = value;
+        }
+        else if (arg == "--workers")
+        {
+            config.workers = std::stoul(value);
+        }
+        else if (arg == "--threads")
+        {
+            config.threads = std::max(1, std::stoi(value));
+        }
+        else if (arg == "--decoders")
+        {
+            config.decoders = std::max<size_t>(1, std::stoul(value));
+        }
+        else if (arg == "--prefetch")
+        {
+            config.prefetch = std::stoul(value);
+        }
+        else
+        {
+            throw std::runtime_error("Unknown option: " + arg);
+        }
+    }
+    if (config.workers == 0)
+    {
+        const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+        config.workers = std::max<size_t>(1, cores / static_cast<size_t>(config.threads));
+    }
+    if (config.prefetch == 0)
+    {
+        config.prefetch = 2 * config.workers;
+    }
+    return config;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        const TranscribeConfig config = parseArgs(argc, argv);
+        const std::vector<std::string> files = collectFiles(config);
+        if (files.empty())
+        {
+            std::cerr << "No input files\n";
+            return 1;
+        }
+
+        std::ofstream output_file;
+        if (!config.output.empty())
+        {
+            output_file.open(config.output);
+            if (!output_file)
+            {
+                throw std::runtime_error("Could not open output file: " + config.output);
+            }
+        }
+        std::ostream &output = config.output.empty() ? std::cout : output_file;
+
+        const auto start = std::chrono::steady_clock::now();
+        RuntimeOptions options;
+        options.intra_op_num_threads = config.threads;
+        MoonshineModel model(config.models_dir, options);
+        const double load_seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << "Loaded model in " << load_seconds << " s; transcribing " << files.size()
+                  << " files with " << config.workers << " workers\n";
+
+        // The decoding threads read and resample files ahead of the workers, so that inference
+        // never waits on disk; the queue bound keeps at most prefetch decoded files in memory
+        PrefetchQueue queue(config.prefetch, config.decoders);
+        std::atomic<size_t> next_file(0);
+        std::vector<std::thread> decoders;
+        for (size_t i = 0; i < config.decoders; ++i)
+        {
+            decoders.emplace_back(
+                [&]
+                {
+                    for (size_t index = next_file++; index < files.size(); index = next_file++)
+                    {
+                        DecodedFile file;
+                        file.index = index;
+                        file.path = files[index];
+                        const auto decode_start = std::chrono::steady_clock::now();
+                        try
+                        {
+                            file.audio = loadAudio(file.path);
+                        }
+                        catch (const std::exception &e)
+                        {
+                            file.error = e.what();
+                        }
+                        file.decoded = std::chrono::steady_clock::now();
+                        file.decode_seconds =
+                            std::chrono::duration<double>(file.decoded - decode_start).count();
+                        queue.push(std::move(file));
+                    }
+                    queue.producerDone();
+                });
+        }
+
+        // Every worker transcribes one file at a time, so long files are chunked serially and
+        // the parallelism comes from the pool
+        LongFormOptions long_form;
+        long_form.num_threads = 1;
+        std::mutex output_mutex;
+        std::atomic<size_t> failures(0);
+        double audio_total = 0.0;
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < config.workers; ++i)
+        {
+            workers.emplace_back(
+                [&]
+                {
+                    DecodedFile file;
+                    while (queue.pop(file))
+                    {
+                        nlohmann::json result = transcribeFile(model, file, long_form);
+                        const bool failed = result.contains("error");
+                        failures += failed ? 1 : 0;
+
+                        // Lines are written as files finish; sort by index to restore input order
+                        std::lock_guard<std::mutex> lock(output_mutex);
+                        audio_total += failed ? 0.0 : result["audio_seconds"].get<double>();
+                        output << result.dump() << "\n";
+                        output.flush();
+                    }
+                });
+        }
+
+        for (auto &decoder : decoders)
+        {
+            decoder.join();
+        }
+        for (auto &worker : workers)
+        {
+            worker.join();
+        }
+
+        const double total_seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << "Transcribed " << files.size() - failures << " of " << files.size()
+                  << " files, " << audio_total << " s of audio, in " << total_seconds
+                  << " s\n";
+        if (failures > 0)
+        {
+            return 1;
+        }
+    }
+    catch (const Ort::Exception &e)
+    {
+        std::cerr << "ONNX Runtime error: " << e.what() << "\n";
+        return 1;
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+import sys
+import argparse
+import os
+import struct
+
+MAGIC = b"MSBUNDLE"
+VERSION = 1
+ENTRY_SIZE = 64
+NAME_SIZE = 48
+ALIGNMENT = 64
+
+MODELS = ["preprocess", "encode", "uncached_decode", "cached_decode"]
+
+
+def align(offset):
+    return (offset + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT
+
+
+def pack_bundle(models_dir, output_path):
+    """
+    Pack the models, their reduced-precision variants and the tokenizer into one bundle,
+    with the decoder weights written by share_decoder_weights.py if present.
+
+    The layout is described in src/model_bundle.hpp.
+
+    Args:
+        models_dir (str): Directory containing the .onnx models and tokenizer.json
+        output_path (str): Path of the bundle file
+    """
+    names = []
+    for suffix in ["", "_fp16", "_int8"]:
+        for extension in [".json", ".bin"]:
+            name = f"decoder_weights{suffix}{extension}"
+            if os.path.exists(os.path.join(models_dir, name)):
+                names.append(name)
+    for model in MODELS:
+        for suffix in ["", "_fp16", "_int8"]:
+            name = f"{model}{suffix}.onnx"
+            if os.path.exists(os.path.join(models_dir, name)):
+                names.append(name)
+            elif not suffix:
+                print(f"Model not found: {os.path.join(models_dir, name)}")
+                sys.exit(1)
+    names.append("tokenizer.json")
+
+    offset = align(16 + ENTRY_SIZE * len(names))
+    entries = []
+    for name in names:
+        size = os.path.getsize(os.path.join(models_dir, name))
+        entries.append((name, offset, size))
+        offset = align(offset + size)
+
+    with open(output_path, "wb") as output:
+        output.write(MAGIC + struct.pack("<II", VERSION, len(entries)))
+        for name, offset, size in entries:
+            encoded = name.encode("utf-8")
+            if len(encoded) >= NAME_SIZE:
+                print(f"File name too long for a bundle: {name}")
+                sys.exit(1)
+            output.write(encoded.ljust(NAME_SIZE, b"\0") + struct.pack("<QQ", offset, size))
+        for name, offset, size in entries:
+            output.write(b"\0" * (offset - output.tell()))
+            with open(os.path.join(models_dir, name), "rb") as source:
+                output.write(source.read())
+            print(f"- {name}: {size} bytes at {offset}")
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Pack a Moonshine models directory into a single memory-mappable bundle"
+    )
+    parser.add_argument("models_dir", help="Directory containing the .onnx models")
+    parser.add_argument("output", help="Path of the bundle file to write")
+    args = parser.parse_args()
+
+    pack_bundle(args.models_dir, args.output)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,73 @@
+import sys
+import argparse
+import os
+
+MODELS = ["preprocess", "encode", "uncached_decode", "cached_decode"]
+
+
+def quantize_int8(model_path, output_path):
+    """
+    Quantize the MatMul weights of a model to int8 with dynamic activation scales.
+
+    Args:
+        model_path (str): Path to the fp32 .onnx model file
+        output_path (str): Path of the quantized model
+    """
+    from onnxruntime.quantization import QuantType, quantize_dynamic
+
+    # Only MatMul is quantized: the decoder time goes into reading its weights, while
+    # quantized convolutions cost the preprocessing model accuracy for little speed
+    quantize_dynamic(
+        model_path,
+        output_path,
+        weight_type=QuantType.QInt8,
+        op_types_to_quantize=["MatMul"],
+        per_channel=True,
+    )
+
+
+def convert_fp16(model_path, output_path):
+    """
+    Convert the weights of a model to float16, keeping float32 inputs and outputs.
+
+    Args:
+        model_path (str): Path to the fp32 .onnx model file
+        output_path (str): Path of the converted model
+    """
+    import onnx
+    from onnxconverter_common import float16
+
+    model = onnx.load(model_path)
+    model = float16.convert_float_to_float16(model, keep_io_types=True)
+    onnx.save(model, output_path)
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Create int8 or fp16 variants of the Moonshine models, named "
+        "<name>_int8.onnx or <name>_fp16.onnx next to the originals"
+    )
+    parser.add_argument("models_dir", help="Directory containing the fp32 .onnx models")
+    parser.add_argument("--precision", choices=["int8", "fp16"], default="int8")
+    parser.add_argument(
+        "--models",
+        nargs="+",
+        choices=MODELS,
+        default=MODELS,
+        help="Models to convert (default: all four)",
+    )
+    args = parser.parse_args()
+
+    convert = quantize_int8 if args.precision == "int8" else convert_fp16
+    for name in args.models:
+        model_path = os.path.join(args.models_dir, name + ".onnx")
+        output_path = os.path.join(args.models_dir, f"{name}_{args.precision}.onnx")
+        if not os.path.exists(model_path):
+            print(f"Model not found: {model_path}")
+            sys.exit(1)
+        print(f"{model_path} -> {output_path}")
+        convert(model_path, output_path)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,145 @@
+import sys
+import argparse
+import hashlib
+import json
+import os
+
+ALIGNMENT = 64
+
+# Smaller initializers stay in the models; registering them costs more than they take
+MIN_BYTES = 1024
+
+DECODERS = ["uncached_decode", "cached_decode"]
+SUFFIXES = {"fp32": "", "fp16": "_fp16", "int8": "_int8"}
+
+# ONNX TensorProto data types with the names the library reads from the manifest
+DTYPES = {1: "float32", 2: "uint8", 3: "int8", 6: "int32", 7: "int64", 10: "float16"}
+
+DATA_FIELDS = [
+    "raw_data",
+    "float_data",
+    "int32_data",
+    "int64_data",
+    "double_data",
+    "uint64_data",
+    "string_data",
+]
+
+
+def align(offset):
+    return (offset + ALIGNMENT - 1) // ALIGNMENT * ALIGNMENT
+
+
+def share_decoder_weights(models_dir, suffix):
+    """
+    Move the weights of both decoders into one file that the library maps once and
+    registers with both sessions as shared initializers.
+
+    Tensors with identical contents are stored once. The decoders are rewritten in place
+    to reference the file as external data, so ONNX Runtime can still load them on its
+    own. Writes decoder_weights<suffix>.bin and decoder_weights<suffix>.json next to the
+    models. The tensors are written in the byte order of this machine, which must be
+    little-endian.
+
+    Args:
+        models_dir (str): Directory containing the decoder .onnx models
+        suffix (str): Precision suffix of the decoders, e.g. "_int8"
+    """
+    import numpy as np
+    import onnx
+    from onnx import numpy_helper
+
+    if sys.byteorder != "little":
+        print("Decoder weights must be written on a little-endian machine")
+        sys.exit(1)
+
+    # Loading also reads any weights already moved out, so the script can be rerun
+    models = {}
+    for decoder in DECODERS:
+        path = os.path.join(models_dir, f"{decoder}{suffix}.onnx")
+        if not os.path.exists(path):
+            print(f"Model not found: {path}")
+            sys.exit(1)
+        models[decoder] = (path, onnx.load(path))
+
+    weights_name = f"decoder_weights{suffix}.bin"
+    tensors = []
+    by_contents = {}
+    offset = 0
+    with open(os.path.join(models_dir, weights_name), "wb") as weights:
+        for decoder, (_, model) in models.items():
+            for initializer in model.graph.initializer:
+                if initializer.data_type not in DTYPES:
+                    continue
+                data = np.ascontiguousarray(numpy_helper.to_array(initializer))
+                if data.nbytes < MIN_BYTES:
+                    continue
+
+                raw = data.tobytes()
+                digest = hashlib.sha256(raw).hexdigest()
+                key = (initializer.data_type, data.shape, digest)
+                if key not in by_contents:
+                    weights.write(b"\0" * (align(offset) - offset))
+                    offset = align(offset)
+                    weights.write(raw)
+                    by_contents[key] = len(tensors)
+                    tensors.append(
+                        {
+                            "dtype": DTYPES[initializer.data_type],
+                            "shape": list(data.shape),
+                            "offset": offset,
+                            "bytes": len(raw),
+                            "names": {},
+                        }
+                    )
+                    offset += len(raw)
+                tensor = tensors[by_contents[key]]
+                tensor["names"].setdefault(decoder, []).append(initializer.name)
+
+                for field in DATA_FIELDS:
+                    initializer.ClearField(field)
+                del initializer.external_data[:]
+                initializer.data_location = onnx.TensorProto.EXTERNAL
+                for name, value in [
+                    ("location", weights_name),
+                    ("offset", str(tensor["offset"])),
+                    ("length", str(tensor["bytes"])),
+                ]:
+                    entry = initializer.external_data.add()
+                    entry.key = name
+                    entry.value = value
+
+    manifest = {"version": 1, "tensors": tensors}
+    manifest_path = os.path.join(models_dir, f"decoder_weights{suffix}.json")
+    with open(manifest_path, "w") as output:
+        json.dump(manifest, output, indent=1)
+
+    for path, model in models.values():
+        onnx.save(model, path)
+
+    shared = sum(1 for tensor in tensors if len(tensor["names"]) > 1)
+    print(
+        f"- {weights_name}: {len(tensors)} tensors, {shared} used by both decoders, "
+        f"{offset} bytes"
+    )
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Move the Moonshine decoder weights into decoder_weights.bin, which "
+        "both decoders and every model in a process share when loaded by the library"
+    )
+    parser.add_argument("models_dir", help="Directory containing the .onnx models")
+    parser.add_argument(
+        "--precision",
+        choices=list(SUFFIXES),
+        default="fp32",
+        help="Precision of the decoders to rewrite (default: fp32)",
+    )
+    args = parser.parse_args()
+
+    share_decoder_weights(args.models_dir, SUFFIXES[args.precision])
+
+
+if __name__ == "__main__":
+    main()
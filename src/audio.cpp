@@ -0,0 +1,386 @@
+#include "audio.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MOONSHINE_AUDIO_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define MOONSHINE_AUDIO_NEON
+#endif
+
+namespace
+{
+
+const uint16_t kWaveFormatPcm = 1;
+const uint16_t kWaveFormatFloat = 3;
+const uint16_t kWaveFormatExtensible = 0xFFFE;
+
+uint16_t readLe16(const uint8_t *bytes)
+{
+    return static_cast<uint16_t>(bytes[0] | (bytes[1] << 8));
+}
+
+uint32_t readLe32(const uint8_t *bytes)
+{
+    return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+           (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+// One sample of any supported format, normalized to [-1.0, 1.0]
+float sampleAt(const uint8_t *bytes, const AudioFormat &format)
+{
+    switch (format.bits_per_sample)
+    {
+        case 8:
+            return (static_cast<float>(bytes[0]) - 128.0f) / 128.0f;
+        case 16:
+            return static_cast<float>(static_cast<int16_t>(readLe16(bytes))) / 32768.0f;
+        case 24:
+        {
+            // Place the three bytes at the top of an int32 so the shift sign-extends them
+            const uint32_t bits = (static_cast<uint32_t>(bytes[0]) << 8) |
+                                  (static_cast<uint32_t>(bytes[1]) << 16) |
+                                  (static_cast<uint32_t>(bytes[2]) << 24);
+            return static_cast<float>(static_cast<int32_t>(bits) >> 8) / 8388608.0f;
+        }
+        default:
+        {
+            if (format.is_float)
+            {
+                float value;
+                std::memcpy(&value, bytes, sizeof(value));
+                return value;
+            }
+            return static_cast<float>(static_cast<int32_t>(readLe32(bytes))) / 2147483648.0f;
+        }
+    }
+}
+
+size_t resampledSize(size_t count, size_t up, size_t down)
+{
+    return (count * up + down - 1) / down;
+}
+
+float dot(const float *a, const float *b, size_t count)
+{
+    size_t i = 0;
+    float sum = 0.0f;
+#if defined(MOONSHINE_AUDIO_SSE2)
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (; i + 8 <= count; i += 8)
+    {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(MOONSHINE_AUDIO_NEON)
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    for (; i + 8 <= count; i += 8)
+    {
+        acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    float lanes[4];
+    vst1q_f32(lanes, vaddq_f32(acc0, acc1));
+    sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+    for (; i < count; ++i)
+    {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+}  // namespace
+
+void int16ToFloat(const int16_t *input, size_t count, float *output)
+{
+    const float scale = 1.0f / 32768.0f;
+    size_t i = 0;
+#if defined(MOONSHINE_AUDIO_SSE2)
+    const __m128 scale4 = _mm_set1_ps(scale);
+    for (; i + 8 <= count; i += 8)
+    {
+        // Interleaving a vector with itself and shifting right sign-extends to 32 bits
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + i));
+        const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+        const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+        _mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale4));
+        _mm_storeu_ps(output + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale4));
+    }
+#elif defined(MOONSHINE_AUDIO_NEON)
+    for (; i + 8 <= count; i += 8)
+    {
+        const int16x8_t x = vld1q_s16(input + i);
+        vst1q_f32(output + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))), scale));
+        vst1q_f32(output + i + 4,
+                  vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(x))), scale));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        output[i] = static_cast<float>(input[i]) * scale;
+    }
+}
+
+void downmixStereoInt16(const int16_t *input, size_t frames, float *output)
+{
+    const float scale = 1.0f / 65536.0f;
+    size_t i = 0;
+#if defined(MOONSHINE_AUDIO_SSE2)
+    // Multiply-add against ones sums each left and right pair into 32 bits
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128 scale4 = _mm_set1_ps(scale);
+    for (; i + 8 <= frames; i += 8)
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + 2 * i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(input + 2 * i + 8));
+        _mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_madd_epi16(a, ones)), scale4));
+        _mm_storeu_ps(output + i + 4,
+                      _mm_mul_ps(_mm_cvtepi32_ps(_mm_madd_epi16(b, ones)), scale4));
+    }
+#elif defined(MOONSHINE_AUDIO_NEON)
+    for (; i + 8 <= frames; i += 8)
+    {
+        // Pairwise widening add sums each left and right pair into 32 bits
+        const int16x8_t a = vld1q_s16(input + 2 * i);
+        const int16x8_t b = vld1q_s16(input + 2 * i + 8);
+        vst1q_f32(output + i, vmulq_n_f32(vcvtq_f32_s32(vpaddlq_s16(a)), scale));
+        vst1q_f32(output + i + 4, vmulq_n_f32(vcvtq_f32_s32(vpaddlq_s16(b)), scale));
+    }
+#endif
+    for (; i < frames; ++i)
+    {
+        output[i] = (static_cast<float>(input[2 * i]) + input[2 * i + 1]) * scale;
+    }
+}
+
+Resampler::Resampler(uint32_t input_rate, uint32_t output_rate, size_t taps)
+{
+    if (input_rate == 0 || output_rate == 0)
+    {
+        throw std::runtime_error("Sample rates must be positive");
+    }
+    const uint32_t divisor = std::gcd(input_rate, output_rate);
+    up_ = output_rate / divisor;
+    down_ = input_rate / divisor;
+    taps_ = std::max<size_t>(1, taps) * std::max<size_t>(1, (down_ + up_ - 1) / up_);
+
+    // Prototype low-pass at up_ times the input rate, cut off a little below the lower of the
+    // two Nyquist frequencies and shaped by a Blackman window
+    const size_t length = up_ * taps_;
+    const size_t center = length / 2;
+    const double cutoff = 0.45 / std::max(up_, down_);
+    const double pi = 3.14159265358979323846;
+    std::vector<double> prototype(length);
+    double sum = 0.0;
+    for (size_t j = 0; j < length; ++j)
+    {
+        const double x = static_cast<double>(j) - static_cast<double>(center);
+        const double arg = 2.0 * pi * cutoff * x;
+        const double sinc = x == 0.0 ? 1.0 : std::sin(arg) / arg;
+        const double phase = 2.0 * pi * (j + 0.5) / length;
+        const double window = 0.42 - 0.5 * std::cos(phase) + 0.08 * std::cos(2.0 * phase);
+        prototype[j] = sinc * window;
+        sum += prototype[j];
+    }
+
+    // Output n reads inputs i_max - k with coefficient h[phase + k * up_], where
+    // n * down_ + center = i_max * up_ + phase. Each phase is stored reversed so that the
+    // product runs forward over the input.
+    phases_.resize(length);
+    for (size_t phase = 0; phase < up_; ++phase)
+    {
+        for (size_t k = 0; k < taps_; ++k)
+        {
+            phases_[phase * taps_ + (taps_ - 1 - k)] =
+                static_cast<float>(prototype[phase + k * up_] * up_ / sum);
+        }
+    }
+}
+
+size_t Resampler::output_size(size_t input_count) const
+{
+    return resampledSize(input_count, up_, down_);
+}
+
+void Resampler::process(const float *input, size_t count, float *output) const
+{
+    const size_t center = up_ * taps_ / 2;
+    const size_t output_count = output_size(count);
+    for (size_t n = 0; n < output_count; ++n)
+    {
+        const size_t position = n * down_ + center;
+        const size_t last = position / up_;
+        const float *coefficients = phases_.data() + (position % up_) * taps_;
+        if (last + 1 >= taps_ && last < count)
+        {
+            output[n] = dot(coefficients, input + last + 1 - taps_, taps_);
+            continue;
+        }
+
+        // Near either end, only the taps that land on the signal contribute
+        float sum = 0.0f;
+        for (size_t m = 0; m < taps_; ++m)
+        {
+            const size_t index = last + 1 + m;
+            if (index >= taps_ && index - taps_ < count)
+            {
+                sum += coefficients[m] * input[index - taps_];
+            }
+        }
+        output[n] = sum;
+    }
+}
+
+AudioFile::AudioFile(const std::string &path, const AudioFormat &raw_format) : mapped_(path)
+{
+    parse(mapped_.data(), mapped_.size(), raw_format);
+}
+
+AudioFile::AudioFile(std::vector<uint8_t> bytes, const AudioFormat &raw_format)
+    : bytes_(std::move(bytes))
+{
+    parse(bytes_.data(), bytes_.size(), raw_format);
+}
+
+void AudioFile::parse(const uint8_t *data, size_t size, const AudioFormat &raw_format)
+{
+    const uint8_t *chunk_data = nullptr;
+    size_t chunk_size = 0;
+    if (size < 12 || std::memcmp(data, "RIFF", 4) != 0)
+    {
+        format_ = raw_format;
+        chunk_data = data;
+        chunk_size = size;
+    }
+    else
+    {
+        if (std::memcmp(data + 8, "WAVE", 4) != 0)
+        {
+            throw std::runtime_error("RIFF file is not WAVE audio");
+        }
+
+        // Walk the chunk list; chunks are padded to an even size
+        bool has_format = false;
+        size_t offset = 12;
+        while (offset + 8 <= size && (!has_format || !chunk_data))
+        {
+            const uint8_t *header = data + offset;
+            const size_t remaining = size - offset - 8;
+            const size_t length = std::min<size_t>(readLe32(header + 4), remaining);
+            if (std::memcmp(header, "fmt ", 4) == 0 && length >= 16)
+            {
+                uint16_t tag = readLe16(header + 8);
+                format_.channels = readLe16(header + 10);
+                format_.sample_rate = readLe32(header + 12);
+                format_.bits_per_sample = readLe16(header + 22);
+                if (tag == kWaveFormatExtensible && length >= 40)
+                {
+                    // The sub-format GUID starts with the actual format tag
+                    tag = readLe16(header + 32);
+                }
+                if (tag != kWaveFormatPcm && tag != kWaveFormatFloat)
+                {
+                    throw std::runtime_error("Unsupported WAV format tag: " +
+                                             std::to_string(tag));
+                }
+                format_.is_float = tag == kWaveFormatFloat;
+                has_format = true;
+            }
+            else if (std::memcmp(header, "data", 4) == 0)
+            {
+                // Streamed files may leave the size unset, so the data runs to the end
+                chunk_data = header + 8;
+                chunk_size = length;
+            }
+            offset += 8 + length + (length & 1);
+        }
+        if (!has_format || !chunk_data)
+        {
+            throw std::runtime_error("WAV file has no fmt or data chunk");
+        }
+    }
+
+    const uint16_t bits = format_.bits_per_sample;
+    if (format_.channels == 0 || format_.sample_rate == 0 ||
+        (bits != 8 && bits != 16 && bits != 24 && bits != 32) || (format_.is_float && bits != 32))
+    {
+        throw std::runtime_error("Unsupported audio format: " + std::to_string(bits) +
+                                 " bits, " + std::to_string(format_.channels) + " channels");
+    }
+    samples_ = chunk_data;
+    frames_ = chunk_size / (format_.channels * (bits / 8));
+}
+
+size_t AudioFile::output_size(uint32_t sample_rate) const
+{
+    const uint32_t divisor = std::gcd(format_.sample_rate, sample_rate);
+    return resampledSize(frames_, sample_rate / divisor, format_.sample_rate / divisor);
+}
+
+void AudioFile::decode(float *output, uint32_t sample_rate) const
+{
+    if (format_.sample_rate == sample_rate)
+    {
+        downmix(output);
+        return;
+    }
+    std::vector<float> mono(frames_);
+    downmix(mono.data());
+    Resampler(format_.sample_rate, sample_rate).process(mono.data(), mono.size(), output);
+}
+
+std::vector<float> AudioFile::decode(uint32_t sample_rate) const
+{
+    std::vector<float> output(output_size(sample_rate));
+    decode(output.data(), sample_rate);
+    return output;
+}
+
+void AudioFile::downmix(float *output) const
+{
+    // WAV samples are little-endian, like every platform the library targets. A data chunk
+    // at an odd address is still valid, e.g. in a writer's nonstandard chunk layout, but
+    // cannot be read as int16_t, so it takes the byte-wise path below.
+    const int16_t *pcm16 = reinterpret_cast<const int16_t *>(samples_);
+    const bool aligned = reinterpret_cast<uintptr_t>(samples_) % alignof(int16_t) == 0;
+    if (aligned && format_.bits_per_sample == 16 && format_.channels == 1)
+    {
+        int16ToFloat(pcm16, frames_, output);
+        return;
+    }
+    if (aligned && format_.bits_per_sample == 16 && format_.channels == 2)
+    {
+        downmixStereoInt16(pcm16, frames_, output);
+        return;
+    }
+
+    const size_t sample_bytes = format_.bits_per_sample / 8;
+    const size_t frame_bytes = sample_bytes * format_.channels;
+    const float scale = 1.0f / format_.channels;
+    for (size_t i = 0; i < frames_; ++i)
+    {
+        const uint8_t *frame = samples_ + i * frame_bytes;
+        float sum = 0.0f;
+        for (size_t c = 0; c < format_.channels; ++c)
+        {
+            sum += sampleAt(frame + c * sample_bytes, format_);
+        }
+        output[i] = sum * scale;
+    }
+}
+
+std::vector<float> loadAudio(const std::string &path)
+{
+    return AudioFile(path).decode();
+}
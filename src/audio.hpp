@@ -0,0 +1,175 @@
+// audio.hpp
+#pragma once
+#include "mapped_file.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @struct AudioFormat
+ * @brief Layout of interleaved PCM samples.
+ */
+struct AudioFormat
+{
+    uint32_t sample_rate = 16000;   ///< Frames per second.
+    uint16_t channels = 1;          ///< Interleaved channels per frame.
+    uint16_t bits_per_sample = 16;  ///< 8, 16, 24 or 32.
+    bool is_float = false;          ///< Whether 32-bit samples are IEEE floats.
+};
+
+/**
+ * @brief Convert 16-bit PCM to normalized float32.
+ * @param input The samples.
+ * @param count The number of samples.
+ * @param output Receives count samples in [-1.0, 1.0).
+ */
+void int16ToFloat(const int16_t *input, size_t count, float *output);
+
+/**
+ * @brief Average interleaved 16-bit stereo into normalized float32 mono.
+ * @param input Interleaved left and right samples.
+ * @param frames The number of frames, half the number of samples.
+ * @param output Receives frames samples.
+ */
+void downmixStereoInt16(const int16_t *input, size_t frames, float *output);
+
+/**
+ * @class Resampler
+ * @brief Polyphase windowed-sinc resampler between two fixed sample rates.
+ *
+ * The rate ratio is reduced to up/down factors L/M and the low-pass filter is split into L
+ * phases, so every output sample is a single short dot product over the input. Common
+ * rates need few phases: 48 kHz to 16 kHz is 1/3 and 44.1 kHz is 160/441.
+ *
+ * process() is const and may be called from several threads at once.
+ */
+class Resampler
+{
+   public:
+    /**
+     * @brief Constructor for the Resampler class.
+     * @param input_rate The sample rate of the input.
+     * @param output_rate The sample rate of the output.
+     * @param taps Filter taps per phase when not decimating; scaled up by the decimation
+     * factor so the transition band stays as narrow relative to the output rate.
+     */
+    Resampler(uint32_t input_rate, uint32_t output_rate, size_t taps = 24);
+
+    /**
+     * @brief Get the number of output samples for an input length.
+     * @param input_count The number of input samples.
+     * @return The number of output samples.
+     */
+    size_t output_size(size_t input_count) const;
+
+    /**
+     * @brief Resample a whole signal; samples beyond either end are taken as silence.
+     * @param input The input samples.
+     * @param count The number of input samples.
+     * @param output Receives output_size(count) samples.
+     */
+    void process(const float *input, size_t count, float *output) const;
+
+   private:
+    size_t up_ = 1;              ///< Interpolation factor L.
+    size_t down_ = 1;            ///< Decimation factor M.
+    size_t taps_ = 0;            ///< Taps per phase.
+    std::vector<float> phases_;  ///< up_ phases of taps_ coefficients, each reversed.
+};
+
+/**
+ * @class AudioFile
+ * @brief WAV or raw PCM audio, parsed in place from a memory mapping or a buffer.
+ *
+ * WAV files may contain any chunks in any order; fmt and data are located by walking the
+ * RIFF chunk list. PCM with 8, 16, 24 or 32 bits, 32-bit float and WAVE_FORMAT_EXTENSIBLE
+ * are supported. Input without a RIFF header is taken as raw PCM in a given format.
+ */
+class AudioFile
+{
+   public:
+    /**
+     * @brief Map and parse a file.
+     * @param path The path of the file.
+     * @param raw_format The format assumed when the file has no RIFF header.
+     */
+    explicit AudioFile(const std::string &path, const AudioFormat &raw_format = AudioFormat());
+
+    /**
+     * @brief Parse audio held in memory.
+     * @param bytes The contents of a WAV file or raw PCM.
+     * @param raw_format The format assumed when the bytes have no RIFF header.
+     */
+    explicit AudioFile(std::vector<uint8_t> bytes,
+                       const AudioFormat &raw_format = AudioFormat());
+
+    AudioFile(const AudioFile &) = delete;
+    AudioFile &operator=(const AudioFile &) = delete;
+
+    /**
+     * @brief Get the format of the stored samples.
+     * @return The format.
+     */
+    const AudioFormat &format() const { return format_; }
+
+    /**
+     * @brief Get the length of the stored audio.
+     * @return The number of frames.
+     */
+    size_t frames() const { return frames_; }
+
+    /**
+     * @brief Get the length after conversion to mono at a sample rate.
+     * @param sample_rate The target sample rate.
+     * @return The number of samples decode() writes.
+     */
+    size_t output_size(uint32_t sample_rate = 16000) const;
+
+    /**
+     * @brief Convert to normalized float32 mono, downmixing and resampling as needed.
+     *
+     * At the target rate samples are converted straight into output; otherwise they are
+     * downmixed into a scratch buffer first.
+     *
+     * @param output Receives output_size(sample_rate) samples; typically the buffer an
+     * input tensor is created on.
+     * @param sample_rate The target sample rate.
+     */
+    void decode(float *output, uint32_t sample_rate = 16000) const;
+
+    /**
+     * @brief Convert to normalized float32 mono in a new buffer.
+     * @param sample_rate The target sample rate.
+     * @return The samples.
+     */
+    std::vector<float> decode(uint32_t sample_rate = 16000) const;
+
+   private:
+    /**
+     * @brief Locate the samples and read their format.
+     * @param data The bytes of the file.
+     * @param size The number of bytes.
+     * @param raw_format The format assumed without a RIFF header.
+     */
+    void parse(const uint8_t *data, size_t size, const AudioFormat &raw_format);
+
+    /**
+     * @brief Convert frames at the stored rate to float32 mono.
+     * @param output Receives frames() samples.
+     */
+    void downmix(float *output) const;
+
+    MappedFile mapped_;                 ///< Mapping of the file, if read from one.
+    std::vector<uint8_t> bytes_;        ///< Contents, if given in memory.
+    const uint8_t *samples_ = nullptr;  ///< First byte of the interleaved samples.
+    size_t frames_ = 0;                 ///< Number of frames.
+    AudioFormat format_;                ///< Format of the samples.
+};
+
+/**
+ * @brief Read an audio file as normalized float32 mono at 16 kHz.
+ * @param path The path of a WAV file or raw 16-bit mono 16 kHz PCM.
+ * @return The samples.
+ */
+std::vector<float> loadAudio(const std::string &path);
@@ -0,0 +1,496 @@
+#include "logits.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define MOONSHINE_LOGITS_AVX2
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define MOONSHINE_TARGET_AVX2
+#else
+#define MOONSHINE_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define MOONSHINE_LOGITS_NEON
+#endif
+
+namespace
+{
+
+const size_t kTopKBlock = 32;  // Logits compared at once when skipping for top-k
+
+// Running state of a one-pass argmax and log-sum-exp
+struct Reduction
+{
+    int32_t index = 0;  // Index of the maximum
+    float max = 0.0f;   // The maximum
+    float sum = 0.0f;   // Sum of exp(logit - max)
+};
+
+// Fold logits [begin, count) into a reduction
+void reduceTail(Reduction &state, const float *logits, size_t begin, size_t count)
+{
+    for (size_t i = begin; i < count; ++i)
+    {
+        if (logits[i] > state.max)
+        {
+            state.sum = state.sum * std::exp(state.max - logits[i]) + 1.0f;
+            state.max = logits[i];
+            state.index = static_cast<int32_t>(i);
+        }
+        else
+        {
+            state.sum += std::exp(logits[i] - state.max);
+        }
+    }
+}
+
+// Merge per-lane reductions; ties go to the lowest index, as in a sequential scan
+Reduction combineLanes(const float *max, const float *sum, const int32_t *index, size_t lanes)
+{
+    Reduction state{index[0], max[0], 0.0f};
+    for (size_t l = 1; l < lanes; ++l)
+    {
+        if (max[l] > state.max || (max[l] == state.max && index[l] < state.index))
+        {
+            state.max = max[l];
+            state.index = index[l];
+        }
+    }
+    for (size_t l = 0; l < lanes; ++l)
+    {
+        state.sum += sum[l] * std::exp(max[l] - state.max);
+    }
+    return state;
+}
+
+int32_t argmaxScalar(const float *logits, size_t count)
+{
+    int32_t index = 0;
+    float max_val = logits[0];
+    for (size_t j = 1; j < count; ++j)
+    {
+        if (logits[j] > max_val)
+        {
+            max_val = logits[j];
+            index = static_cast<int32_t>(j);
+        }
+    }
+    return index;
+}
+
+Reduction reduceScalar(const float *logits, size_t count)
+{
+    Reduction state{0, logits[0], 1.0f};
+    reduceTail(state, logits, 1, count);
+    return state;
+}
+
+bool blockAboveScalar(const float *logits, float threshold)
+{
+    for (size_t i = 0; i < kTopKBlock; ++i)
+    {
+        if (logits[i] > threshold)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifdef MOONSHINE_LOGITS_AVX2
+
+// exp() to about 1 ulp over the float range: 2^n * p(r) with n = round(x / ln 2)
+MOONSHINE_TARGET_AVX2 inline __m256 expAvx2(__m256 x)
+{
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.3f)), _mm256_set1_ps(88.3f));
+    const __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504f)),
+                                     _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+    __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+    p = _mm256_add_ps(_mm256_fmadd_ps(p, _mm256_mul_ps(r, r), r), _mm256_set1_ps(1.0f));
+    const __m256i exponent = _mm256_slli_epi32(
+        _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(exponent));
+}
+
+MOONSHINE_TARGET_AVX2 int32_t argmaxAvx2(const float *logits, size_t count)
+{
+    if (count < 8)
+    {
+        return argmaxScalar(logits, count);
+    }
+
+    // Each lane keeps its own maximum and where it was; strict comparisons keep the first
+    __m256 best = _mm256_loadu_ps(logits);
+    __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i best_index = index;
+    const __m256i step = _mm256_set1_epi32(8);
+    size_t i = 8;
+    for (; i + 8 <= count; i += 8)
+    {
+        index = _mm256_add_epi32(index, step);
+        const __m256 values = _mm256_loadu_ps(logits + i);
+        const __m256 greater = _mm256_cmp_ps(values, best, _CMP_GT_OQ);
+        best = _mm256_blendv_ps(best, values, greater);
+        best_index = _mm256_blendv_epi8(best_index, index, _mm256_castps_si256(greater));
+    }
+
+    float lane_max[8];
+    int32_t lane_index[8];
+    _mm256_storeu_ps(lane_max, best);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lane_index), best_index);
+    float max_val = lane_max[0];
+    int32_t result = lane_index[0];
+    for (size_t l = 1; l < 8; ++l)
+    {
+        if (lane_max[l] > max_val || (lane_max[l] == max_val && lane_index[l] < result))
+        {
+            max_val = lane_max[l];
+            result = lane_index[l];
+        }
+    }
+    for (; i < count; ++i)
+    {
+        if (logits[i] > max_val)
+        {
+            max_val = logits[i];
+            result = static_cast<int32_t>(i);
+        }
+    }
+    return result;
+}
+
+MOONSHINE_TARGET_AVX2 Reduction reduceAvx2(const float *logits, size_t count)
+{
+    if (count < 8)
+    {
+        return reduceScalar(logits, count);
+    }
+
+    __m256 max = _mm256_loadu_ps(logits);
+    __m256 sum = _mm256_set1_ps(1.0f);
+    __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i max_index = index;
+    const __m256i step = _mm256_set1_epi32(8);
+    size_t i = 8;
+    for (; i + 8 <= count; i += 8)
+    {
+        index = _mm256_add_epi32(index, step);
+        const __m256 values = _mm256_loadu_ps(logits + i);
+        const __m256 greater = _mm256_cmp_ps(values, max, _CMP_GT_OQ);
+        const __m256 new_max = _mm256_blendv_ps(max, values, greater);
+        // Rescale the sum to the new maximum and add this block
+        sum = _mm256_fmadd_ps(sum, expAvx2(_mm256_sub_ps(max, new_max)),
+                              expAvx2(_mm256_sub_ps(values, new_max)));
+        max = new_max;
+        max_index = _mm256_blendv_epi8(max_index, index, _mm256_castps_si256(greater));
+    }
+
+    float lane_max[8];
+    float lane_sum[8];
+    int32_t lane_index[8];
+    _mm256_storeu_ps(lane_max, max);
+    _mm256_storeu_ps(lane_sum, sum);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lane_index), max_index);
+    Reduction state = combineLanes(lane_max, lane_sum, lane_index, 8);
+    reduceTail(state, logits, i, count);
+    return state;
+}
+
+MOONSHINE_TARGET_AVX2 bool blockAboveAvx2(const float *logits, float threshold)
+{
+    const __m256 limit = _mm256_set1_ps(threshold);
+    __m256 above = _mm256_setzero_ps();
+    for (size_t i = 0; i < kTopKBlock; i += 8)
+    {
+        above = _mm256_or_ps(above,
+                             _mm256_cmp_ps(_mm256_loadu_ps(logits + i), limit, _CMP_GT_OQ));
+    }
+    return _mm256_movemask_ps(above) != 0;
+}
+
+bool cpuHasAvx2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+    // FMA, OSXSAVE and AVX, then the OS must save the YMM registers
+    __cpuid(info, 1);
+    const int required = (1 << 12) | (1 << 27) | (1 << 28);
+    if ((info[2] & required) != required || (_xgetbv(0) & 6) != 6)
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+#endif  // MOONSHINE_LOGITS_AVX2
+
+#ifdef MOONSHINE_LOGITS_NEON
+
+inline float32x4_t expNeon(float32x4_t x)
+{
+    x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(-87.3f)), vdupq_n_f32(88.3f));
+    const float32x4_t n = vrndnq_f32(vmulq_n_f32(x, 1.44269504f));
+    float32x4_t r = vfmsq_f32(x, n, vdupq_n_f32(0.693359375f));
+    r = vfmsq_f32(r, n, vdupq_n_f32(-2.12194440e-4f));
+    float32x4_t p = vdupq_n_f32(1.9875691500e-4f);
+    p = vfmaq_f32(vdupq_n_f32(1.3981999507e-3f), p, r);
+    p = vfmaq_f32(vdupq_n_f32(8.3334519073e-3f), p, r);
+    p = vfmaq_f32(vdupq_n_f32(4.1665795894e-2f), p, r);
+    p = vfmaq_f32(vdupq_n_f32(1.6666665459e-1f), p, r);
+    p = vfmaq_f32(vdupq_n_f32(5.0000001201e-1f), p, r);
+    p = vaddq_f32(vfmaq_f32(r, p, vmulq_f32(r, r)), vdupq_n_f32(1.0f));
+    const int32x4_t exponent = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(n), vdupq_n_s32(127)), 23);
+    return vmulq_f32(p, vreinterpretq_f32_s32(exponent));
+}
+
+int32_t argmaxNeon(const float *logits, size_t count)
+{
+    if (count < 4)
+    {
+        return argmaxScalar(logits, count);
+    }
+
+    float32x4_t best = vld1q_f32(logits);
+    const int32_t first[4] = {0, 1, 2, 3};
+    int32x4_t index = vld1q_s32(first);
+    int32x4_t best_index = index;
+    const int32x4_t step = vdupq_n_s32(4);
+    size_t i = 4;
+    for (; i + 4 <= count; i += 4)
+    {
+        index = vaddq_s32(index, step);
+        const float32x4_t values = vld1q_f32(logits + i);
+        const uint32x4_t greater = vcgtq_f32(values, best);
+        best = vbslq_f32(greater, values, best);
+        best_index = vbslq_s32(greater, index, best_index);
+    }
+
+    float lane_max[4];
+    int32_t lane_index[4];
+    vst1q_f32(lane_max, best);
+    vst1q_s32(lane_index, best_index);
+    float max_val = lane_max[0];
+    int32_t result = lane_index[0];
+    for (size_t l = 1; l < 4; ++l)
+    {
+        if (lane_max[l] > max_val || (lane_max[l] == max_val && lane_index[l] < result))
+        {
+            max_val = lane_max[l];
+            result = lane_index[l];
+        }
+    }
+    for (; i < count; ++i)
+    {
+        if (logits[i] > max_val)
+        {
+            max_val = logits[i];
+            result = static_cast<int32_t>(i);
+        }
+    }
+    return result;
+}
+
+Reduction reduceNeon(const float *logits, size_t count)
+{
+    if (count < 4)
+    {
+        return reduceScalar(logits, count);
+    }
+
+    float32x4_t max = vld1q_f32(logits);
+    float32x4_t sum = vdupq_n_f32(1.0f);
+    const int32_t first[4] = {0, 1, 2, 3};
+    int32x4_t index = vld1q_s32(first);
+    int32x4_t max_index = index;
+    const int32x4_t step = vdupq_n_s32(4);
+    size_t i = 4;
+    for (; i + 4 <= count; i += 4)
+    {
+        index = vaddq_s32(index, step);
+        const float32x4_t values = vld1q_f32(logits + i);
+        const uint32x4_t greater = vcgtq_f32(values, max);
+        const float32x4_t new_max = vbslq_f32(greater, values, max);
+        // Rescale the sum to the new maximum and add this block
+        sum = vfmaq_f32(expNeon(vsubq_f32(values, new_max)), sum,
+                        expNeon(vsubq_f32(max, new_max)));
+        max = new_max;
+        max_index = vbslq_s32(greater, index, max_index);
+    }
+
+    float lane_max[4];
+    float lane_sum[4];
+    int32_t lane_index[4];
+    vst1q_f32(lane_max, max);
+    vst1q_f32(lane_sum, sum);
+    vst1q_s32(lane_index, max_index);
+    Reduction state = combineLanes(lane_max, lane_sum, lane_index, 4);
+    reduceTail(state, logits, i, count);
+    return state;
+}
+
+bool blockAboveNeon(const float *logits, float threshold)
+{
+    const float32x4_t limit = vdupq_n_f32(threshold);
+    uint32x4_t above = vdupq_n_u32(0);
+    for (size_t i = 0; i < kTopKBlock; i += 4)
+    {
+        above = vorrq_u32(above, vcgtq_f32(vld1q_f32(logits + i), limit));
+    }
+    return vmaxvq_u32(above) != 0;
+}
+
+#endif  // MOONSHINE_LOGITS_NEON
+
+struct Kernels
+{
+    LogitsKernel kind = LogitsKernel::Scalar;
+    int32_t (*argmax)(const float *, size_t) = argmaxScalar;
+    Reduction (*reduce)(const float *, size_t) = reduceScalar;
+    bool (*block_above)(const float *, float) = blockAboveScalar;
+};
+
+Kernels selectKernels()
+{
+    Kernels selected;
+#if defined(MOONSHINE_LOGITS_AVX2)
+    if (cpuHasAvx2())
+    {
+        selected = {LogitsKernel::Avx2, argmaxAvx2, reduceAvx2, blockAboveAvx2};
+    }
+#elif defined(MOONSHINE_LOGITS_NEON)
+    selected = {LogitsKernel::Neon, argmaxNeon, reduceNeon, blockAboveNeon};
+#endif
+    return selected;
+}
+
+const Kernels &kernels()
+{
+    static const Kernels selected = selectKernels();
+    return selected;
+}
+
+// Heap order with the weakest candidate at the front; equal logits favor the lower ID
+bool stronger(const TokenScore &a, const TokenScore &b)
+{
+    return a.logit > b.logit || (a.logit == b.logit && a.token < b.token);
+}
+
+// Offer a token to a heap of at most k candidates
+void offer(TokenScore *heap, size_t &size, size_t k, int32_t token, float logit)
+{
+    const TokenScore candidate{token, logit};
+    if (size < k)
+    {
+        heap[size++] = candidate;
+        std::push_heap(heap, heap + size, stronger);
+    }
+    else if (stronger(candidate, heap[0]))
+    {
+        std::pop_heap(heap, heap + size, stronger);
+        heap[size - 1] = candidate;
+        std::push_heap(heap, heap + size, stronger);
+    }
+}
+
+}  // namespace
+
+LogitsKernel logitsKernel()
+{
+    return kernels().kind;
+}
+
+int32_t argmaxLogits(const float *logits, size_t count)
+{
+    return kernels().argmax(logits, count);
+}
+
+TokenChoice selectToken(const float *logits, size_t count)
+{
+    const Reduction state = kernels().reduce(logits, count);
+    TokenChoice choice;
+    choice.token = state.index;
+    choice.logit = state.max;
+    choice.log_prob = -std::log(state.sum);  // logit - (max + log(sum)), with logit == max
+    return choice;
+}
+
+float logSumExp(const float *logits, size_t count)
+{
+    const Reduction state = kernels().reduce(logits, count);
+    return state.max + std::log(state.sum);
+}
+
+void logSoftmax(const float *logits, size_t count, float *output)
+{
+    const float offset = logSumExp(logits, count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        output[i] = logits[i] - offset;
+    }
+}
+
+size_t topK(const float *logits, size_t count, size_t k, TokenScore *output)
+{
+    // output doubles as the heap, so nothing is allocated
+    k = std::min(k, count);
+    if (k == 0)
+    {
+        return 0;
+    }
+    const Kernels &selected = kernels();
+    size_t size = 0;
+    size_t i = 0;
+    for (; i + kTopKBlock <= count; i += kTopKBlock)
+    {
+        // Tokens come in increasing order, so only a strictly higher logit can enter a full
+        // heap
+        if (size == k && !selected.block_above(logits + i, output[0].logit))
+        {
+            continue;
+        }
+        for (size_t j = i; j < i + kTopKBlock; ++j)
+        {
+            offer(output, size, k, static_cast<int32_t>(j), logits[j]);
+        }
+    }
+    for (; i < count; ++i)
+    {
+        offer(output, size, k, static_cast<int32_t>(i), logits[i]);
+    }
+    std::sort_heap(output, output + size, stronger);
+    return size;
+}
+
+void suppressTokens(float *logits, size_t count, const std::vector<int32_t> &tokens)
+{
+    // The lowest finite value rather than -infinity keeps the running log-sum-exp free of
+    // infinity minus infinity when a suppressed token comes first
+    for (int32_t token : tokens)
+    {
+        if (token >= 0 && static_cast<size_t>(token) < count)
+        {
+            logits[token] = std::numeric_limits<float>::lowest();
+        }
+    }
+}
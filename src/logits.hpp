@@ -0,0 +1,100 @@
+// logits.hpp
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Instruction sets the logits kernels can run on.
+ */
+enum class LogitsKernel
+{
+    Scalar,  ///< Portable C++.
+    Avx2,    ///< AVX2 and FMA on x86-64, chosen at run time.
+    Neon     ///< NEON on 64-bit ARM, where it is always present.
+};
+
+/**
+ * @struct TokenScore
+ * @brief A candidate token and its logit.
+ */
+struct TokenScore
+{
+    int32_t token = 0;   ///< The token ID.
+    float logit = 0.0f;  ///< The raw score of the token.
+};
+
+/**
+ * @struct TokenChoice
+ * @brief The most likely token and its log probability.
+ */
+struct TokenChoice
+{
+    int32_t token = 0;      ///< The token ID with the highest logit.
+    float logit = 0.0f;     ///< Its logit.
+    float log_prob = 0.0f;  ///< Its log probability under the softmax of all logits.
+};
+
+/**
+ * @brief Get the kernel set selected for this CPU on first use.
+ * @return The instruction set the functions below run on.
+ */
+LogitsKernel logitsKernel();
+
+/**
+ * @brief Find the token with the highest logit; ties go to the lowest ID.
+ * @param logits The logits of one sequence.
+ * @param count The vocabulary size.
+ * @return The token ID.
+ */
+int32_t argmaxLogits(const float *logits, size_t count);
+
+/**
+ * @brief Find the token with the highest logit and its log probability in one pass.
+ *
+ * The maximum and the sum of exponentials are accumulated together, with the sum rescaled
+ * whenever the running maximum grows, so the logits are read once.
+ *
+ * @param logits The logits of one sequence.
+ * @param count The vocabulary size.
+ * @return The token, its logit and its log probability.
+ */
+TokenChoice selectToken(const float *logits, size_t count);
+
+/**
+ * @brief Compute log(sum(exp(logits))) without overflow.
+ * @param logits The logits of one sequence.
+ * @param count The vocabulary size.
+ * @return The log of the softmax denominator.
+ */
+float logSumExp(const float *logits, size_t count);
+
+/**
+ * @brief Convert logits to log probabilities.
+ * @param logits The logits of one sequence.
+ * @param count The vocabulary size.
+ * @param output Receives count log probabilities; may be logits itself.
+ */
+void logSoftmax(const float *logits, size_t count, float *output);
+
+/**
+ * @brief Find the k highest logits without sorting the vocabulary.
+ *
+ * Blocks of logits that cannot beat the current k-th best are skipped with one vector
+ * comparison, so after the first few blocks almost all of the vocabulary is only compared.
+ *
+ * @param logits The logits of one sequence.
+ * @param count The vocabulary size.
+ * @param k The number of candidates.
+ * @param output Receives min(k, count) candidates, highest logit first.
+ * @return The number of candidates written.
+ */
+size_t topK(const float *logits, size_t count, size_t k, TokenScore *output);
+
+/**
+ * @brief Mask tokens so that they are never selected and get no probability.
+ * @param logits The logits of one sequence, modified in place.
+ * @param count The vocabulary size.
+ * @param tokens The token IDs to mask; IDs outside the vocabulary are ignored.
+ */
+void suppressTokens(float *logits, size_t count, const std::vector<int32_t> &tokens);
@@ -0,0 +1,61 @@
+// mapped_file.hpp
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @class MappedFile
+ * @brief Read-only memory mapping of a whole file.
+ *
+ * Pages are loaded by the operating system on first access and shared with its page cache,
+ * so opening a file costs no read and no copy.
+ */
+class MappedFile
+{
+   public:
+    /**
+     * @brief Create an empty mapping.
+     */
+    MappedFile() = default;
+
+    /**
+     * @brief Map a file.
+     * @param path The path of the file.
+     */
+    explicit MappedFile(const std::string &path);
+
+    /**
+     * @brief Destructor for the MappedFile class; unmaps the file.
+     */
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    /**
+     * @brief Get the mapped bytes.
+     * @return The first byte of the file, or nullptr if the mapping is empty.
+     */
+    const uint8_t *data() const { return data_; }
+
+    /**
+     * @brief Get the size of the file.
+     * @return The size in bytes.
+     */
+    size_t size() const { return size_; }
+
+   private:
+    /**
+     * @brief Unmap the file and reset to an empty mapping.
+     */
+    void close();
+
+    const uint8_t *data_ = nullptr;  ///< The mapped bytes.
+    size_t size_ = 0;                ///< The size of the mapping in bytes.
+#ifdef _WIN32
+    void *mapping_ = nullptr;  ///< Handle of the file mapping object.
+#endif
+};
@@ -0,0 +1,84 @@
+#include "model_bundle.hpp"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+
+const char kMagic[8] = {'M', 'S', 'B', 'U', 'N', 'D', 'L', 'E'};
+const uint32_t kVersion = 1;
+const size_t kHeaderSize = 16;
+const size_t kEntrySize = 64;
+const size_t kNameSize = 48;
+
+// Read a little-endian integer independently of the host byte order
+template <typename T>
+T readLittleEndian(const uint8_t *bytes)
+{
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i)
+    {
+        value |= static_cast<T>(bytes[i]) << (8 * i);
+    }
+    return value;
+}
+
+}  // namespace
+
+ModelBundle::ModelBundle(const std::string &path) : path_(path), mapping_(path)
+{
+    const uint8_t *data = mapping_.data();
+    const size_t size = mapping_.size();
+    if (size < kHeaderSize || std::memcmp(data, kMagic, sizeof(kMagic)) != 0)
+    {
+        throw std::runtime_error("Not a model bundle: " + path);
+    }
+    const uint32_t version = readLittleEndian<uint32_t>(data + 8);
+    if (version != kVersion)
+    {
+        throw std::runtime_error("Unsupported model bundle version " + std::to_string(version) +
+                                 ": " + path);
+    }
+    const uint32_t count = readLittleEndian<uint32_t>(data + 12);
+    if (count > (size - kHeaderSize) / kEntrySize)
+    {
+        throw std::runtime_error("Truncated model bundle table of contents: " + path);
+    }
+
+    entries_.reserve(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const uint8_t *entry = data + kHeaderSize + i * kEntrySize;
+        const char *name = reinterpret_cast<const char *>(entry);
+        Entry parsed;
+        parsed.name.assign(name, std::find(name, name + kNameSize, '\0'));
+        parsed.offset = readLittleEndian<uint64_t>(entry + kNameSize);
+        parsed.size = readLittleEndian<uint64_t>(entry + kNameSize + 8);
+        if (parsed.offset > size || parsed.size > size - parsed.offset)
+        {
+            throw std::runtime_error("Model bundle entry " + parsed.name +
+                                     " lies outside the file: " + path);
+        }
+        entries_.push_back(std::move(parsed));
+    }
+}
+
+bool ModelBundle::contains(std::string_view name) const
+{
+    return std::any_of(entries_.begin(), entries_.end(),
+                       [name](const Entry &entry) { return entry.name == name; });
+}
+
+std::string_view ModelBundle::file(std::string_view name) const
+{
+    for (const Entry &entry : entries_)
+    {
+        if (entry.name == name)
+        {
+            return std::string_view(reinterpret_cast<const char *>(mapping_.data()) + entry.offset,
+                                    static_cast<size_t>(entry.size));
+        }
+    }
+    throw std::runtime_error("Model bundle " + path_ + " has no file named " + std::string(name));
+}
@@ -0,0 +1,67 @@
+// model_bundle.hpp
+#pragma once
+#include "mapped_file.hpp"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @class ModelBundle
+ * @brief Read-only view of the files packed into one memory-mapped bundle.
+ *
+ * A bundle holds the four ONNX models, tokenizer.json and optionally reduced-precision
+ * variants under their usual file names, so a model is opened with one mapping instead of
+ * five reads. The mapping only saves the reads: ONNX Runtime copies the initializers of
+ * every session out of it, so the weights still take memory in each process. The exception
+ * is decoder_weights.bin, written by scripts/share_decoder_weights.py, which the decoders
+ * use in place. Bundles are written by scripts/pack_bundle.py.
+ *
+ * Layout, little-endian: the magic "MSBUNDLE", a uint32 format version, a uint32 entry
+ * count, then one 64-byte entry per file holding its NUL-padded name (48 bytes), a uint64
+ * offset from the start of the bundle and a uint64 size. File contents follow, each aligned
+ * to 64 bytes.
+ */
+class ModelBundle
+{
+   public:
+    /**
+     * @brief Map a bundle and read its table of contents.
+     * @param path The path of the bundle file.
+     * @throws std::runtime_error if the file is not a valid bundle.
+     */
+    explicit ModelBundle(const std::string &path);
+
+    /**
+     * @brief Check whether the bundle holds a file.
+     * @param name The file name, e.g. "encode.onnx".
+     * @return True if the file is present.
+     */
+    bool contains(std::string_view name) const;
+
+    /**
+     * @brief Get the contents of a file without copying them.
+     * @param name The file name, e.g. "encode.onnx".
+     * @return A view into the mapping, valid as long as the bundle.
+     * @throws std::runtime_error if the file is not in the bundle.
+     */
+    std::string_view file(std::string_view name) const;
+
+    /**
+     * @brief Get the path the bundle was opened from.
+     * @return The path.
+     */
+    const std::string &path() const { return path_; }
+
+   private:
+    struct Entry
+    {
+        std::string name;  ///< File name.
+        uint64_t offset;   ///< Offset of the contents from the start of the bundle.
+        uint64_t size;     ///< Size of the contents in bytes.
+    };
+
+    std::string path_;            ///< Path of the bundle file.
+    MappedFile mapping_;          ///< The mapped bundle.
+    std::vector<Entry> entries_;  ///< Table of contents.
+};
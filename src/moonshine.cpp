@@ -1,10 +1,23 @@
 #include "moonshine.hpp"
+#include "logits.hpp"
+#include "mapped_file.hpp"
+#include "model_bundle.hpp"
 #include <filesystem>
 #include <stdexcept>
 #include <iostream>
 #include <nlohmann/json.hpp>
-#include <fstream>
 #include <sstream>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <limits>
+#include <chrono>
+#include <iomanip>
+#include <map>
+#include <cmath>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -38,87 +51,1624 @@ std::vector<const char *> decode_output_names = {
     "functional_37_3",
 };
 
+std::vector<const char *> preprocess_input_names = {"args_0"};
+std::vector<const char *> preprocess_output_names = {"sequential"};
+
 std::vector<const char *> encode_input_names = {"args_0", "args_1"};
 std::vector<const char *> encode_ouput_names = {"layer_normalization_12"};
 
-// Function to read a UTF-8 encoded file into a string
-std::string readFileAsUtf8(const std::string &file_path)
+/**
+ * @brief Per-model state for the token loop.
+ *
+ * The KV-cache outputs of cached_decode are written into two sets of preallocated byte
+ * buffers. Each step reads the cache from one set and binds its outputs to the other, so
+ * the buffers are only ever resized when an utterance needs more room than any before it.
+ * Rows of the cache, context and token tensors are batch entries; rows of finished
+ * sequences are dropped so that later steps only run over the sequences still decoding.
+ */
+struct MoonshineModel::DecoderState
+{
+    DecoderState(Ort::Session &uncached, Ort::Session &cached, const Ort::MemoryInfo &info)
+        : uncached_session(uncached),
+          cached_session(cached),
+          memory_info(info),
+          uncached_binding(uncached),
+          cached_binding(cached)
+    {
+        const int64_t scalar_shape = 1;
+        seq_len_tensor =
+            Ort::Value::CreateTensor<int32_t>(memory_info, &seq_len, 1, &scalar_shape, 1);
+        for (const char *name : decode_output_names)
+        {
+            uncached_binding.BindOutput(name, memory_info);
+        }
+    }
+
+    /**
+     * @brief Point the token, context and logits views at the first rows of their buffers
+     * and rebind them.
+     * @param batch The number of rows in the next decoder step.
+     */
+    void resizeBatch(size_t batch);
+
+    /**
+     * @brief Run the uncached decoder and move its cache into the ping-pong buffers.
+     * @param capacity The maximum number of cached steps that will follow.
+     * @param run_options Run options for the decoder.
+     * @return The uncached decoder outputs; the first one holds the logits.
+     */
+    std::vector<Ort::Value> runUncached(size_t capacity, const Ort::RunOptions &run_options);
+
+    /**
+     * @brief Run one cached decoder step, reading the cache from the current buffers and
+     * writing it into the other ones.
+     * @param capacity The maximum number of cached steps in this utterance.
+     * @param run_options Run options for the decoder.
+     * @return Bytes of outputs ONNX Runtime allocated, which is 0 once the layout is known.
+     */
+    size_t runCached(size_t capacity, const Ort::RunOptions &run_options);
+
+    /**
+     * @brief Keep only the given batch rows of the cache, in the given order.
+     * @param rows The source row of each row in the new cache.
+     */
+    void selectRows(const std::vector<size_t> &rows);
+
+    /**
+     * @brief Grow the ping-pong buffers to fit the given number of cached steps.
+     * @param capacity The maximum number of cached steps in this utterance.
+     */
+    void reserve(size_t capacity);
+
+    Ort::Session &uncached_session;      ///< The uncached decoding session.
+    Ort::Session &cached_session;        ///< The cached decoding session.
+    const Ort::MemoryInfo &memory_info;  ///< Memory information for the bound views.
+    Ort::IoBinding uncached_binding;     ///< Binding for the first (uncached) decoder step.
+    Ort::IoBinding cached_binding;       ///< Binding for the cached decoder steps.
+
+    std::vector<int32_t> tokens;         ///< Backing storage for the bound token input.
+    int32_t seq_len = 0;                 ///< Backing storage for the bound seq_len input.
+    Ort::Value token_tensor{nullptr};    ///< View of tokens, bound to both decoders.
+    Ort::Value seq_len_tensor{nullptr};  ///< View of seq_len, bound to both decoders.
+
+    float *context_data = nullptr;       ///< Encoder output, compacted in place.
+    std::vector<int64_t> context_shape;  ///< Shape of the bound context view.
+    Ort::Value context_tensor{nullptr};  ///< View of the context, bound to both decoders.
+
+    std::vector<float> logits;          ///< Preallocated logits output of cached_decode.
+    std::vector<int64_t> logits_shape;  ///< Shape of the bound logits output.
+    Ort::Value logits_tensor{nullptr};  ///< View of logits, bound as output.
+
+    bool layout_known = false;     ///< Whether growth_axis has been learned from a real step.
+    std::vector<int> growth_axis;  ///< Per cache: axis growing by one per step, or -1.
+
+    std::vector<ONNXTensorElementDataType> element_type;  ///< Per cache element type.
+    std::vector<size_t> element_size;                     ///< Per cache element size in bytes.
+    std::vector<std::vector<int64_t>> initial_shapes;     ///< Per cache uncached step shape.
+    std::vector<std::vector<int64_t>> input_shapes;       ///< Per cache shape read by a step.
+    std::vector<std::vector<int64_t>> output_shapes;      ///< Per cache shape written by it.
+    std::vector<std::vector<uint8_t>> buffers[2];         ///< Ping-pong cache storage.
+    int current = 0;                                      ///< Buffers holding the latest cache.
+
+    std::vector<size_t> active;  ///< Sequence index of each row still decoding.
+    std::vector<size_t> keep;    ///< Rows surviving the current step.
+
+    size_t max_rows = 0;              ///< Most batch rows the cache buffers must hold.
+    std::vector<float> beam_context;  ///< The context repeated once per beam.
+};
+
+struct MoonshineModel::GenerateCall
+{
+    GenerateCall(const GenerateOptions &generate_options, const Tokenizer &tokenizer)
+        : options(generate_options),
+          detokenizer(tokenizer),
+          start(std::chrono::steady_clock::now()),
+          last_token(start)
+    {
+        if (options.cancel)
+        {
+            options.cancel->attach(run_options);
+        }
+    }
+
+    ~GenerateCall()
+    {
+        if (options.cancel)
+        {
+            options.cancel->detach(run_options);
+        }
+    }
+
+    GenerateCall(const GenerateCall &) = delete;
+    GenerateCall &operator=(const GenerateCall &) = delete;
+
+    /**
+     * @brief Check whether the call's cancellation token has been cancelled.
+     * @return True if the call should stop.
+     */
+    bool cancelled() const
+    {
+        return options.cancel && options.cancel->cancelled();
+    }
+
+    /**
+     * @brief Check the stop tokens and the repetition limit after a token was appended.
+     * @param tokens The sequence, starting with the start token.
+     * @param reason Set to the reason if one of them ends generation.
+     * @return True if generation should stop.
+     */
+    bool stopsAfter(const std::vector<int32_t> &tokens, StopReason &reason) const;
+
+    /**
+     * @brief Check whether the deadline has passed, setting stop_reason if it has.
+     * @return True if generation should stop.
+     */
+    bool pastDeadline()
+    {
+        if (options.deadline != std::chrono::steady_clock::time_point::max() &&
+            std::chrono::steady_clock::now() >= options.deadline)
+        {
+            stop_reason = StopReason::Deadline;
+            return true;
+        }
+        return false;
+    }
+
+    const GenerateOptions &options;                    ///< Options passed to generate().
+    IncrementalDetokenizer detokenizer;                ///< Text of the reported tokens.
+    Ort::RunOptions run_options;                       ///< Terminated on cancellation.
+    StopReason stop_reason = StopReason::EndToken;     ///< Why the last segment stopped.
+    std::chrono::steady_clock::time_point start;       ///< When the call began.
+    std::chrono::steady_clock::time_point last_token;  ///< When the last token was reported.
+    std::vector<float> log_probs;  ///< Per token of the current segment, if requested.
+};
+
+struct MoonshineModel::EncoderBuffers
+{
+    EncoderBuffers(Ort::Session &preprocess, Ort::Session &encode, const Ort::MemoryInfo &info,
+                   size_t samples)
+        : preprocess_session(preprocess),
+          encode_session(encode),
+          memory_info(info),
+          preprocess_binding(preprocess),
+          encode_binding(encode),
+          audio(samples, 0.0f)
+    {
+        const int64_t audio_shape[] = {1, static_cast<int64_t>(samples)};
+        audio_tensor = Ort::Value::CreateTensor<float>(memory_info, audio.data(), audio.size(),
+                                                       audio_shape, 2);
+        const int64_t scalar_shape = 1;
+        seq_len_tensor =
+            Ort::Value::CreateTensor<int32_t>(memory_info, &seq_len, 1, &scalar_shape, 1);
+        preprocess_binding.BindInput(preprocess_input_names[0], audio_tensor);
+        preprocess_binding.BindOutput(preprocess_output_names[0], memory_info);
+        encode_binding.BindInput(encode_input_names[1], seq_len_tensor);
+        encode_binding.BindOutput(encode_ouput_names[0], memory_info);
+    }
+
+    /**
+     * @brief Pad audio to the bucket length and run the preprocessing and encoding models.
+     * @param samples The audio samples.
+     * @param count The number of samples, at most the bucket length.
+     * @param run_options Run options for both models.
+     * @param stats Optional stats to add the stage timings and output sizes to.
+     * @param frames Receives the number of preprocessed frames that cover the real audio.
+     * @return A view of the encoder output frames that cover the real audio.
+     */
+    Ort::Value run(const float *samples, size_t count, const Ort::RunOptions &run_options,
+                   GenerateStats *stats, int32_t &frames);
+
+    Ort::Session &preprocess_session;    ///< The preprocessing session.
+    Ort::Session &encode_session;        ///< The encoding session.
+    const Ort::MemoryInfo &memory_info;  ///< Memory information for the bound views.
+    Ort::IoBinding preprocess_binding;   ///< Binding for the preprocessing model.
+    Ort::IoBinding encode_binding;       ///< Binding for the encoding model.
+
+    std::vector<float> audio;            ///< Padded input audio of the bucket length.
+    Ort::Value audio_tensor{nullptr};    ///< View of audio, bound as input.
+    int32_t seq_len = 0;                 ///< Frames of the padded audio, bound as input.
+    Ort::Value seq_len_tensor{nullptr};  ///< View of seq_len.
+
+    std::vector<float> features;           ///< Preprocessing output, bound once learned.
+    std::vector<int64_t> features_shape;   ///< Shape of features.
+    Ort::Value features_tensor{nullptr};   ///< View of features.
+    std::vector<float> context;            ///< Encoder output, bound once learned.
+    std::vector<int64_t> context_shape;    ///< Shape of context.
+    Ort::Value context_tensor{nullptr};    ///< View of context.
+    bool shapes_known = false;  ///< Whether the outputs are bound to the buffers above.
+    bool reusable = false;      ///< Whether the last run completed, so the buffers may be reused.
+};
+
+struct MoonshineModel::EncodedSegment
+{
+    std::vector<Ort::Value> context;  ///< Encoder outputs; the first one holds the context.
+    int32_t seq_len = 0;              ///< Sequence length of the preprocessed audio.
+    size_t sample_count = 0;          ///< Length of the segment in samples.
+    std::shared_ptr<EncoderBuffers> buffers;  ///< Bucket buffers holding the context, if any.
+};
+
+struct MoonshineModel::EncodedRequest
+{
+    EncodedRequest(const GenerateOptions &options, const Tokenizer &tokenizer)
+        : call(options, tokenizer)
+    {
+    }
+
+    GenerateCall call;                     ///< Options, run options and timing of the call.
+    std::vector<EncodedSegment> segments;  ///< Speech segments, in order.
+};
+
+struct MoonshineModel::SharedWeights
+{
+    /**
+     * @brief Create tensors over the decoder weights listed in a manifest.
+     * @param owner Keeps the weights mapped for as long as the tensors exist.
+     * @param manifest Contents of decoder_weights.json.
+     * @param weights Contents of decoder_weights.bin, at least 64-byte aligned.
+     * @param weights_name The file name the decoders reference the weights by.
+     * @throws std::runtime_error if the manifest does not match the weights.
+     */
+    SharedWeights(std::shared_ptr<const void> owner, std::string_view manifest,
+                  std::string_view weights, std::string weights_name);
+
+    std::shared_ptr<const void> owner;  ///< The mapping the weights are read from.
+    std::string_view weights;           ///< Contents of the weights file.
+    std::string weights_name;           ///< File name of the weights, as in the decoders.
+    std::vector<Ort::Value> tensors;    ///< Tensors over the weights, used in place.
+    std::map<std::string, std::vector<std::pair<std::string, size_t>>>
+        initializers;  ///< Initializer names and their tensors, per decoder.
+    Ort::PrepackedWeightsContainer prepacked;  ///< Packed GEMM buffers of the tensors.
+};
+
+void CancellationToken::cancel()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    cancelled_ = true;
+    for (Ort::RunOptions *run_options : runs_)
+    {
+        run_options->SetTerminate();
+    }
+}
+
+bool CancellationToken::cancelled() const
+{
+    return cancelled_;
+}
+
+void CancellationToken::attach(Ort::RunOptions &run_options)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (cancelled_)
+    {
+        run_options.SetTerminate();
+    }
+    runs_.push_back(&run_options);
+}
+
+void CancellationToken::detach(Ort::RunOptions &run_options)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    runs_.erase(std::remove(runs_.begin(), runs_.end(), &run_options), runs_.end());
+}
+
+namespace
+{
+
+size_t elementSize(ONNXTensorElementDataType type)
+{
+    switch (type)
+    {
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT:
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT32:
+            return 4;
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16:
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT16:
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT16:
+            return 2;
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64:
+            return 8;
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT8:
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT8:
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_BOOL:
+            return 1;
+        default:
+            throw std::runtime_error("Unsupported KV-cache element type");
+    }
+}
+
+// Element type of a tensor in decoder_weights.json, named as by numpy
+ONNXTensorElementDataType tensorElementType(const std::string &dtype)
+{
+    static const std::map<std::string, ONNXTensorElementDataType> types = {
+        {"float32", ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT},
+        {"float16", ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16},
+        {"int64", ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64},
+        {"int32", ONNX_TENSOR_ELEMENT_DATA_TYPE_INT32},
+        {"int8", ONNX_TENSOR_ELEMENT_DATA_TYPE_INT8},
+        {"uint8", ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT8},
+    };
+    const auto found = types.find(dtype);
+    if (found == types.end())
+    {
+        throw std::runtime_error("Unsupported decoder weight type: " + dtype);
+    }
+    return found->second;
+}
+
+size_t elementCount(const std::vector<int64_t> &shape)
+{
+    size_t count = 1;
+    for (int64_t dim : shape)
+    {
+        count *= static_cast<size_t>(dim);
+    }
+    return count;
+}
+
+size_t tensorBytes(const std::vector<Ort::Value> &values)
+{
+    size_t bytes = 0;
+    for (const auto &value : values)
+    {
+        auto info = value.GetTensorTypeAndShapeInfo();
+        bytes += info.GetElementCount() * elementSize(info.GetElementType());
+    }
+    return bytes;
+}
+
+// A sequence kept by beam search
+struct BeamHypothesis
+{
+    std::vector<int32_t> tokens;                // Start token, then the generated tokens
+    std::vector<float> log_probs;               // Per generated token
+    float score = 0.0f;                         // Sum of log_probs
+    StopReason reason = StopReason::MaxLength;  // Why it finished, once it has
+};
+
+// A one-token extension of a beam
+struct BeamCandidate
+{
+    size_t beam;     // Row of the beam it extends
+    int32_t token;   // The new token
+    float log_prob;  // Log probability of the token
+    float score;     // Score of the extended beam
+};
+
+// Whether the tokens after the start token end with count back-to-back copies of one n-gram
+// of at most max_ngram tokens
+bool endsInRepetition(const std::vector<int32_t> &tokens, size_t max_ngram, size_t count)
+{
+    const size_t length = tokens.size() - 1;
+    for (size_t n = 1; n <= max_ngram && n * count <= length; ++n)
+    {
+        // The tail of n * count tokens repeats with period n
+        bool periodic = true;
+        for (size_t j = tokens.size() - n * (count - 1); j < tokens.size() && periodic; ++j)
+        {
+            periodic = tokens[j] == tokens[j - n];
+        }
+        if (periodic)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Sessions are created from a file whenever their buffer is empty, so an empty buffer given
+// in place of a model is rejected instead of loading a file from the working directory
+std::string_view requireContents(std::string_view contents, const std::string &name)
 {
-    std::ifstream file(file_path, std::ios::binary);
-    if (!file.is_open())
+    if (contents.empty())
+    {
+        throw std::runtime_error("Model buffer is empty: " + name);
+    }
+    return contents;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The settings of the four sessions, in the order they are created
+std::vector<const SessionConfig *> sessionConfigs(const RuntimeOptions &options)
+{
+    return {&options.preprocess_session, &options.encode_session,
+            &options.uncached_decode_session, &options.cached_decode_session};
+}
+
+// Register the shared CPU arena with the Env once per process, if any session uses it
+void registerSharedArena(Ort::Env &env, const RuntimeOptions &options)
+{
+    static std::mutex mutex;
+    static bool registered = false;
+
+    const auto configs = sessionConfigs(options);
+    if (std::none_of(configs.begin(), configs.end(),
+                     [](const SessionConfig *config) { return config->use_shared_arena; }))
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!registered)
+    {
+        const ArenaConfig &arena = options.shared_arena;
+        Ort::MemoryInfo info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+        Ort::ArenaCfg arena_config(arena.max_memory, arena.extend_strategy,
+                                   arena.initial_chunk_size_bytes, arena.max_dead_bytes_per_chunk);
+        env.CreateAndRegisterAllocator(info, arena_config);
+        registered = true;
+    }
+}
+
+// Hash bytes 64 bits at a time, FNV-1a style, mixing in the length of every 1 MB chunk
+uint64_t hashBytes(std::string_view bytes)
+{
+    const size_t chunk_size = 1 << 20;
+    uint64_t hash = 14695981039346656037ULL;
+    size_t offset = 0;
+    size_t count = 0;
+    do
+    {
+        count = std::min(chunk_size, bytes.size() - offset);
+        for (size_t i = 0; i < count; i += sizeof(uint64_t))
+        {
+            // The last partial word is zero-padded
+            uint64_t word = 0;
+            std::memcpy(&word, bytes.data() + offset + i, std::min(sizeof(uint64_t), count - i));
+            hash = (hash ^ word) * 1099511628211ULL;
+        }
+        hash = (hash ^ count) * 1099511628211ULL;
+        offset += count;
+    } while (count == chunk_size);
+    return hash;
+}
+
+uint64_t hashFile(const std::string &file_path)
+{
+    if (!std::filesystem::exists(file_path))
     {
         throw std::runtime_error("File not found: " + file_path);
     }
+    MappedFile file(file_path);
+    return hashBytes(std::string_view(reinterpret_cast<const char *>(file.data()), file.size()));
+}
+
+// ONNX Runtime takes wide-character paths on Windows and narrow ones elsewhere
+std::filesystem::path::string_type ortPath(const std::filesystem::path &path)
+{
+    return path.native();
+}
+
+// Suffix of the files of a model at the given precision
+const char *precisionSuffix(ModelPrecision precision)
+{
+    return precision == ModelPrecision::Int8   ? "_int8"
+           : precision == ModelPrecision::Fp16 ? "_fp16"
+                                               : "";
+}
+
+// File name of a model at the given precision
+std::string modelFileName(const char *name, ModelPrecision precision)
+{
+    return std::string(name) + precisionSuffix(precision) + ".onnx";
+}
+
+ModelPrecision parsePrecision(const std::string &name)
+{
+    if (name == "fp32")
+    {
+        return ModelPrecision::Fp32;
+    }
+    if (name == "fp16")
+    {
+        return ModelPrecision::Fp16;
+    }
+    if (name == "int8")
+    {
+        return ModelPrecision::Int8;
+    }
+    throw std::runtime_error("Unknown model precision: " + name + " (use fp32, fp16 or int8)");
+}
+
+const char *elementTypeName(ONNXTensorElementDataType type)
+{
+    switch (type)
+    {
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT:
+            return "float";
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16:
+            return "float16";
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT32:
+            return "int32";
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64:
+            return "int64";
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT8:
+            return "int8";
+        case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT8:
+            return "uint8";
+        default:
+            return "another type";
+    }
+}
+
+// A tensor the code binds by name; UNDEFINED accepts any element type
+struct ExpectedTensor
+{
+    const char *name;
+    ONNXTensorElementDataType type;
+};
+
+// Build the expected tensors from a name list, typing the leading ones
+std::vector<ExpectedTensor> expectedTensors(const std::vector<const char *> &names,
+                                            const std::vector<ONNXTensorElementDataType> &types)
+{
+    std::vector<ExpectedTensor> tensors;
+    for (size_t i = 0; i < names.size(); ++i)
+    {
+        tensors.push_back(
+            {names[i], i < types.size() ? types[i] : ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED});
+    }
+    return tensors;
+}
+
+// Check that a session has exactly the expected inputs, and the expected outputs among its own
+void validateSession(const Ort::Session &session, const std::string &path,
+                     const std::vector<ExpectedTensor> &inputs,
+                     const std::vector<ExpectedTensor> &outputs)
+{
+    Ort::AllocatorWithDefaultOptions allocator;
+    auto check = [&](const char *kind, size_t count, const std::vector<ExpectedTensor> &expected,
+                     bool exact, auto name_of, auto type_of)
+    {
+        std::vector<std::pair<std::string, ONNXTensorElementDataType>> actual;
+        for (size_t i = 0; i < count; ++i)
+        {
+            actual.emplace_back(name_of(i).get(), type_of(i));
+        }
+        for (const ExpectedTensor &tensor : expected)
+        {
+            auto it = std::find_if(actual.begin(), actual.end(),
+                                   [&](const auto &entry) { return entry.first == tensor.name; });
+            if (it == actual.end())
+            {
+                throw std::runtime_error(path + " has no " + kind + " named " + tensor.name +
+                                         "; export it with the tensor names of the fp32 model");
+            }
+            if (tensor.type != ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED && it->second != tensor.type)
+            {
+                throw std::runtime_error(path + ": " + kind + " " + tensor.name + " is " +
+                                         elementTypeName(it->second) + ", expected " +
+                                         elementTypeName(tensor.type) +
+                                         "; reduced-precision models must keep float32 I/O");
+            }
+        }
+        if (exact && actual.size() != expected.size())
+        {
+            throw std::runtime_error(path + " has " + std::to_string(actual.size()) + " " + kind +
+                                     "s, expected " + std::to_string(expected.size()));
+        }
+    };
+    check(
+        "input", session.GetInputCount(), inputs, true,
+        [&](size_t i) { return session.GetInputNameAllocated(i, allocator); },
+        [&](size_t i)
+        { return session.GetInputTypeInfo(i).GetTensorTypeAndShapeInfo().GetElementType(); });
+    check(
+        "output", session.GetOutputCount(), outputs, false,
+        [&](size_t i) { return session.GetOutputNameAllocated(i, allocator); },
+        [&](size_t i)
+        { return session.GetOutputTypeInfo(i).GetTensorTypeAndShapeInfo().GetElementType(); });
+}
+
+// Find the start of the quietest 10 ms frame in [begin, end)
+size_t quietestPoint(const float *audio, size_t begin, size_t end)
+{
+    const size_t frame = 160;
+    size_t best = begin;
+    float best_energy = std::numeric_limits<float>::max();
+    for (size_t start = begin; start + frame <= end; start += frame)
+    {
+        float energy = 0.0f;
+        for (size_t i = start; i < start + frame; ++i)
+        {
+            energy += audio[i] * audio[i];
+        }
+        if (energy < best_energy)
+        {
+            best_energy = energy;
+            best = start;
+        }
+    }
+    return best;
+}
+
+// Append the tokens of the next chunk to merged, dropping the run of tokens both chunks
+// decoded from their shared audio. The longest common run between the tail of merged and
+// the head of next is taken as the overlap; merged is cut after it and next resumes after it,
+// which also discards a word clipped at the end of the earlier chunk.
+void mergeOverlap(std::vector<int32_t> &merged, const std::vector<int32_t> &next, size_t window)
+{
+    const size_t tail = std::min(window, merged.size());
+    const size_t head = std::min(window, next.size());
+    const size_t tail_start = merged.size() - tail;
+
+    // Longest common substring by dynamic programming over the two windows
+    size_t best_length = 0;
+    size_t best_merged_end = 0;
+    size_t best_next_end = 0;
+    std::vector<size_t> previous(head + 1, 0);
+    std::vector<size_t> current(head + 1, 0);
+    for (size_t i = 1; i <= tail; ++i)
+    {
+        for (size_t j = 1; j <= head; ++j)
+        {
+            current[j] = merged[tail_start + i - 1] == next[j - 1] ? previous[j - 1] + 1 : 0;
+            if (current[j] > best_length)
+            {
+                best_length = current[j];
+                best_merged_end = tail_start + i;
+                best_next_end = j;
+            }
+        }
+        std::swap(previous, current);
+    }
+
+    // A single shared token is too weak a match to drop anything for
+    if (best_length >= 2)
+    {
+        merged.resize(best_merged_end);
+        merged.insert(merged.end(), next.begin() + best_next_end, next.end());
+    }
+    else
+    {
+        merged.insert(merged.end(), next.begin(), next.end());
+    }
+}
+
+}  // namespace
+
+MoonshineModel::SharedWeights::SharedWeights(std::shared_ptr<const void> owner,
+                                             std::string_view manifest, std::string_view weights,
+                                             std::string weights_name)
+    : owner(std::move(owner)), weights(weights), weights_name(std::move(weights_name))
+{
+    if (reinterpret_cast<uintptr_t>(weights.data()) % 64 != 0)
+    {
+        throw std::runtime_error("Decoder weights are not aligned: " + this->weights_name);
+    }
+
+    const nlohmann::json contents = nlohmann::json::parse(manifest.begin(), manifest.end());
+    if (contents.at("version").get<int>() != 1)
+    {
+        throw std::runtime_error("Unsupported decoder weights version in " + this->weights_name);
+    }
+
+    // Tensors only view the weights; ONNX Runtime reads them in place from every session
+    Ort::MemoryInfo info = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+    for (const auto &tensor : contents.at("tensors"))
+    {
+        const ONNXTensorElementDataType type =
+            tensorElementType(tensor.at("dtype").get<std::string>());
+        const auto shape = tensor.at("shape").get<std::vector<int64_t>>();
+        const auto offset = tensor.at("offset").get<uint64_t>();
+        const auto bytes = tensor.at("bytes").get<uint64_t>();
+        if (offset > weights.size() || bytes > weights.size() - offset ||
+            bytes != elementCount(shape) * elementSize(type) || offset % elementSize(type) != 0)
+        {
+            throw std::runtime_error("Decoder weights do not match their manifest: " +
+                                     this->weights_name);
+        }
+
+        for (const auto &[decoder, names] : tensor.at("names").items())
+        {
+            for (const auto &name : names)
+            {
+                initializers[decoder].emplace_back(name.get<std::string>(), tensors.size());
+            }
+        }
+        void *data = const_cast<char *>(weights.data() + offset);
+        tensors.push_back(
+            Ort::Value::CreateTensor(info, data, bytes, shape.data(), shape.size(), type));
+    }
+}
+
+std::shared_ptr<MoonshineModel::SharedWeights> MoonshineModel::sharedWeights(
+    const std::string &key, const std::function<std::shared_ptr<SharedWeights>()> &load)
+{
+    // The models own the weights; once the last of them is destroyed the weights are unmapped
+    // and their packed buffers freed, and the next model loads them again
+    static std::mutex mutex;
+    static std::map<std::string, std::weak_ptr<SharedWeights>> loaded;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<SharedWeights> weights = loaded[key].lock();
+    if (!weights)
+    {
+        weights = load();
+        loaded[key] = weights;
+    }
+    return weights;
+}
+
+Ort::Value MoonshineModel::EncoderBuffers::run(const float *samples, size_t count,
+                                               const Ort::RunOptions &run_options,
+                                               GenerateStats *stats, int32_t &frames)
+{
+    reusable = false;
+    std::copy(samples, samples + count, audio.begin());
+    std::fill(audio.begin() + count, audio.end(), 0.0f);
+
+    // On the first run ORT allocates the outputs, which tells their shapes for the bucket.
+    // Later runs write straight into the buffers.
+    auto start = std::chrono::steady_clock::now();
+    preprocess_session.Run(run_options, preprocess_binding);
+    if (!shapes_known)
+    {
+        std::vector<Ort::Value> outputs = preprocess_binding.GetOutputValues();
+        features_shape = outputs[0].GetTensorTypeAndShapeInfo().GetShape();
+        const float *data = outputs[0].GetTensorData<float>();
+        features.assign(data, data + elementCount(features_shape));
+        features_tensor = Ort::Value::CreateTensor<float>(
+            memory_info, features.data(), features.size(), features_shape.data(),
+            features_shape.size());
+        preprocess_binding.BindOutput(preprocess_output_names[0], features_tensor);
+        encode_binding.BindInput(encode_input_names[0], features_tensor);
+        seq_len = static_cast<int32_t>(features_shape[1]);
+        if (stats)
+        {
+            stats->ort_allocated_bytes += tensorBytes(outputs);
+        }
+    }
+    if (stats)
+    {
+        stats->preprocess_seconds += secondsSince(start);
+    }
+
+    start = std::chrono::steady_clock::now();
+    encode_session.Run(run_options, encode_binding);
+    if (!shapes_known)
+    {
+        std::vector<Ort::Value> outputs = encode_binding.GetOutputValues();
+        context_shape = outputs[0].GetTensorTypeAndShapeInfo().GetShape();
+        const float *data = outputs[0].GetTensorData<float>();
+        context.assign(data, data + elementCount(context_shape));
+        context_tensor =
+            Ort::Value::CreateTensor<float>(memory_info, context.data(), context.size(),
+                                            context_shape.data(), context_shape.size());
+        encode_binding.BindOutput(encode_ouput_names[0], context_tensor);
+        shapes_known = true;
+        if (stats)
+        {
+            stats->ort_allocated_bytes += tensorBytes(outputs);
+        }
+    }
+    if (stats)
+    {
+        stats->encode_seconds += secondsSince(start);
+    }
+    reusable = true;
+
+    // The decoder only sees the frames of the real audio, which lead the padded output. Its
+    // position offset starts at the preprocessed frames of the real audio, as without padding.
+    // Those frames still differ from an unpadded run, as the encoder attended to the padding.
+    const int64_t padded_samples = static_cast<int64_t>(audio.size());
+    auto real = [&](int64_t padded_frames)
+    {
+        return std::max<int64_t>(
+            1, (padded_frames * static_cast<int64_t>(count) + padded_samples - 1) / padded_samples);
+    };
+    frames = static_cast<int32_t>(real(features_shape[1]));
+    std::vector<int64_t> shape = context_shape;
+    shape[1] = real(context_shape[1]);
+    return Ort::Value::CreateTensor<float>(memory_info, context.data(), elementCount(shape),
+                                           shape.data(), shape.size());
+}
+
+bool MoonshineModel::GenerateCall::stopsAfter(const std::vector<int32_t> &tokens,
+                                              StopReason &reason) const
+{
+    const int32_t token = tokens.back();
+    if (std::find(options.stop_tokens.begin(), options.stop_tokens.end(), token) !=
+        options.stop_tokens.end())
+    {
+        reason = StopReason::StopToken;
+        return true;
+    }
+    if (options.repetition_count > 1 &&
+        endsInRepetition(tokens, options.repetition_max_ngram, options.repetition_count))
+    {
+        reason = StopReason::Repetition;
+        return true;
+    }
+    return false;
+}
+
+void MoonshineModel::DecoderState::resizeBatch(size_t batch)
+{
+    const int64_t rows = static_cast<int64_t>(batch);
+    const std::vector<int64_t> token_shape = {rows, 1};
+    tokens.resize(batch);
+    token_tensor = Ort::Value::CreateTensor<int32_t>(memory_info, tokens.data(), tokens.size(),
+                                                     token_shape.data(), token_shape.size());
+
+    context_shape[0] = rows;
+    context_tensor = Ort::Value::CreateTensor<float>(memory_info, context_data,
+                                                     elementCount(context_shape),
+                                                     context_shape.data(), context_shape.size());
+
+    for (auto *binding : {&uncached_binding, &cached_binding})
+    {
+        binding->BindInput(decode_input_names[0], token_tensor);
+        binding->BindInput(decode_input_names[1], context_tensor);
+        binding->BindInput(decode_input_names[2], seq_len_tensor);
+    }
+
+    if (!logits_shape.empty())
+    {
+        logits_shape[0] = rows;
+        size_t count = elementCount(logits_shape);
+        if (logits.size() < count)
+        {
+            logits.resize(count);
+        }
+        logits_tensor = Ort::Value::CreateTensor<float>(memory_info, logits.data(), count,
+                                                        logits_shape.data(), logits_shape.size());
+    }
+}
+
+std::vector<Ort::Value> MoonshineModel::DecoderState::runUncached(
+    size_t capacity, const Ort::RunOptions &run_options)
+{
+    uncached_session.Run(run_options, uncached_binding);
+    std::vector<Ort::Value> outputs = uncached_binding.GetOutputValues();
+
+    const size_t cache_count = outputs.size() - 1;
+    if (!layout_known)
+    {
+        growth_axis.assign(cache_count, -1);
+        element_type.resize(cache_count);
+        element_size.resize(cache_count);
+    }
+    initial_shapes.resize(cache_count);
+    input_shapes.resize(cache_count);
+    output_shapes.resize(cache_count);
+    for (size_t j = 0; j < cache_count; ++j)
+    {
+        auto info = outputs[j + 1].GetTensorTypeAndShapeInfo();
+        initial_shapes[j] = info.GetShape();
+        element_type[j] = info.GetElementType();
+        element_size[j] = elementSize(element_type[j]);
+        if (initial_shapes[j].empty() || initial_shapes[j][0] != context_shape[0])
+        {
+            throw std::runtime_error("Unsupported KV-cache layout: batch must be the first axis");
+        }
+    }
+    reserve(capacity);
+
+    // Copy the initial cache into the buffers read by the first cached step
+    current = 0;
+    for (size_t j = 0; j < cache_count; ++j)
+    {
+        output_shapes[j] = initial_shapes[j];
+        std::memcpy(buffers[current][j].data(), outputs[j + 1].GetTensorRawData(),
+                    elementCount(initial_shapes[j]) * element_size[j]);
+    }
+
+    logits_shape = outputs[0].GetTensorTypeAndShapeInfo().GetShape();
+    resizeBatch(static_cast<size_t>(context_shape[0]));
+    return outputs;
+}
+
+size_t MoonshineModel::DecoderState::runCached(size_t capacity,
+                                               const Ort::RunOptions &run_options)
+{
+    const size_t cache_count = output_shapes.size();
+
+    // The cache written by the previous step becomes this step's input
+    for (size_t j = 0; j < cache_count; ++j)
+    {
+        input_shapes[j] = output_shapes[j];
+        Ort::Value cache = Ort::Value::CreateTensor(
+            memory_info, buffers[current][j].data(),
+            elementCount(input_shapes[j]) * element_size[j], input_shapes[j].data(),
+            input_shapes[j].size(), element_type[j]);
+        cached_binding.BindInput(cached_decode_input_names[j + 3], cache);
+    }
+
+    if (!layout_known)
+    {
+        // Let ORT allocate the outputs once to learn which axis of each cache grows
+        cached_binding.ClearBoundOutputs();
+        for (const char *name : cached_decode_output_names)
+        {
+            cached_binding.BindOutput(name, memory_info);
+        }
+        cached_session.Run(run_options, cached_binding);
+        std::vector<Ort::Value> outputs = cached_binding.GetOutputValues();
+        cached_binding.ClearBoundOutputs();
+
+        for (size_t j = 0; j < cache_count; ++j)
+        {
+            output_shapes[j] = outputs[j + 1].GetTensorTypeAndShapeInfo().GetShape();
+            for (size_t axis = 0; axis < output_shapes[j].size(); ++axis)
+            {
+                if (output_shapes[j][axis] == input_shapes[j][axis] + 1)
+                {
+                    growth_axis[j] = static_cast<int>(axis);
+                    break;
+                }
+            }
+        }
+        layout_known = true;
+        reserve(capacity);
+
+        for (size_t j = 0; j < cache_count; ++j)
+        {
+            std::memcpy(buffers[1 - current][j].data(), outputs[j + 1].GetTensorRawData(),
+                        elementCount(output_shapes[j]) * element_size[j]);
+        }
+        std::memcpy(logits.data(), outputs[0].GetTensorRawData(),
+                    elementCount(logits_shape) * sizeof(float));
+        current = 1 - current;
+        return tensorBytes(outputs);
+    }
+
+    // Bind the outputs to the other half of the ping-pong buffers
+    for (size_t j = 0; j < cache_count; ++j)
+    {
+        output_shapes[j] = input_shapes[j];
+        if (growth_axis[j] >= 0)
+        {
+            output_shapes[j][growth_axis[j]] += 1;
+        }
+        Ort::Value cache = Ort::Value::CreateTensor(
+            memory_info, buffers[1 - current][j].data(),
+            elementCount(output_shapes[j]) * element_size[j], output_shapes[j].data(),
+            output_shapes[j].size(), element_type[j]);
+        cached_binding.BindOutput(cached_decode_output_names[j + 1], cache);
+    }
+    cached_binding.BindOutput(cached_decode_output_names[0], logits_tensor);
+
+    cached_session.Run(run_options, cached_binding);
+    current = 1 - current;
+    return 0;
+}
+
+void MoonshineModel::DecoderState::selectRows(const std::vector<size_t> &rows)
+{
+    for (size_t j = 0; j < output_shapes.size(); ++j)
+    {
+        const size_t row_bytes =
+            elementCount(output_shapes[j]) / output_shapes[j][0] * element_size[j];
+        const uint8_t *src = buffers[current][j].data();
+        uint8_t *dst = buffers[1 - current][j].data();
+        for (size_t k = 0; k < rows.size(); ++k)
+        {
+            std::memcpy(dst + k * row_bytes, src + rows[k] * row_bytes, row_bytes);
+        }
+        output_shapes[j][0] = static_cast<int64_t>(rows.size());
+    }
+    current = 1 - current;
+}
+
+void MoonshineModel::DecoderState::reserve(size_t capacity)
+{
+    for (int side = 0; side < 2; ++side)
+    {
+        buffers[side].resize(initial_shapes.size());
+    }
+    for (size_t j = 0; j < initial_shapes.size(); ++j)
+    {
+        // Beam search grows the batch past that of the uncached step
+        const size_t initial_rows = static_cast<size_t>(initial_shapes[j][0]);
+        size_t elements =
+            elementCount(initial_shapes[j]) / initial_rows * std::max(max_rows, initial_rows);
+        if (growth_axis[j] >= 0)
+        {
+            const size_t length = static_cast<size_t>(initial_shapes[j][growth_axis[j]]);
+            elements = elements / length * (length + capacity);
+        }
+        const size_t bytes = elements * element_size[j];
+        for (int side = 0; side < 2; ++side)
+        {
+            if (buffers[side][j].size() < bytes)
+            {
+                buffers[side][j].resize(bytes);
+            }
+        }
+    }
+}
+
+ModelPrecisions parseModelPrecisions(const std::string &spec)
+{
+    ModelPrecisions precisions;
+    if (spec == "mixed")
+    {
+        precisions.decode = ModelPrecision::Int8;
+        return precisions;
+    }
+    if (spec.find('=') == std::string::npos)
+    {
+        const ModelPrecision precision = parsePrecision(spec);
+        return {precision, precision, precision};
+    }
 
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    return buffer.str();
+    std::stringstream stream(spec);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        const size_t equals = item.find('=');
+        const std::string model = item.substr(0, equals);
+        const ModelPrecision precision =
+            parsePrecision(equals == std::string::npos ? "" : item.substr(equals + 1));
+        if (model == "preprocess")
+        {
+            precisions.preprocess = precision;
+        }
+        else if (model == "encode")
+        {
+            precisions.encode = precision;
+        }
+        else if (model == "decode")
+        {
+            precisions.decode = precision;
+        }
+        else
+        {
+            throw std::runtime_error("Unknown model in precision specification: " + model +
+                                     " (use preprocess, encode or decode)");
+        }
+    }
+    return precisions;
 }
 
-MoonshineModel::MoonshineModel(const std::string &models_dir)
-    : memory_info_(Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU))
+MoonshineModel::MoonshineModel(const std::string &models_dir, const RuntimeOptions &options)
+    : env_(shared_env(options)),
+      options_(options),
+      memory_info_(Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU))
 {
     std::cout << "Initializing Moonshine model from " << models_dir << std::endl;
-    this->env_ = Ort::Env(ORT_LOGGING_LEVEL_WARNING, "MoonshineModel");
-    preprocess_ = createSession(models_dir + "/preprocess.onnx");
-    encode_ = createSession(models_dir + "/encode.onnx");
-    uncached_decode_ = createSession(models_dir + "/uncached_decode.onnx");
-    cached_decode_ = createSession(models_dir + "/cached_decode.onnx");
+    const ModelPrecisions &precision = options_.precision;
+    const std::vector<std::string> names = {
+        modelFileName("preprocess", precision.preprocess),
+        modelFileName("encode", precision.encode),
+        modelFileName("uncached_decode", precision.decode),
+        modelFileName("cached_decode", precision.decode),
+    };
+
+    // Written next to the decoders by scripts/share_decoder_weights.py
+    const std::string weights_stem =
+        std::string("decoder_weights") + precisionSuffix(precision.decode);
+    const std::string manifest_name = weights_stem + ".json";
+    const std::string weights_name = weights_stem + ".bin";
+
+    std::vector<std::string> paths;
+    if (std::filesystem::is_regular_file(models_dir))
+    {
+        // The models are only read while the sessions are created, which copy the weights
+        // they keep out of the mapping. Shared decoder weights are used in place and keep it.
+        auto bundle = std::make_shared<ModelBundle>(models_dir);
+        if (bundle->contains(manifest_name))
+        {
+            // Decoders loaded from memory cannot read the weights file, so they need the
+            // weights registered even when they are not shared with other models
+            auto load = [&]
+            {
+                return std::make_shared<SharedWeights>(
+                    bundle, bundle->file(manifest_name),
+                    requireContents(bundle->file(weights_name), weights_name), weights_name);
+            };
+            shared_weights_ = options_.share_decoder_weights
+                                  ? sharedWeights(std::filesystem::canonical(models_dir).string() +
+                                                      "/" + weights_name,
+                                                  load)
+                                  : load();
+        }
+        std::vector<std::string_view> models;
+        for (const std::string &name : names)
+        {
+            paths.push_back(models_dir + "/" + name);
+            models.push_back(requireContents(bundle->file(name), name));
+        }
+        initialize(paths, models, bundle->file("tokenizer.json"));
+        return;
+    }
+
+    for (const std::string &name : names)
+    {
+        paths.push_back(models_dir + "/" + name);
+    }
+    const std::string manifest_path = models_dir + "/" + manifest_name;
+    const std::string weights_path = models_dir + "/" + weights_name;
+    if (options_.share_decoder_weights && std::filesystem::exists(manifest_path))
+    {
+        if (!std::filesystem::exists(weights_path))
+        {
+            throw std::runtime_error("Decoder weights not found: " + weights_path);
+        }
+        shared_weights_ = sharedWeights(
+            std::filesystem::canonical(weights_path).string(),
+            [&]
+            {
+                MappedFile manifest(manifest_path);
+                auto weights = std::make_shared<MappedFile>(weights_path);
+                return std::make_shared<SharedWeights>(
+                    weights,
+                    std::string_view(reinterpret_cast<const char *>(manifest.data()),
+                                     manifest.size()),
+                    std::string_view(reinterpret_cast<const char *>(weights->data()),
+                                     weights->size()),
+                    weights_name);
+            });
+    }
+    MappedFile tokenizer(models_dir + "/tokenizer.json");
+    const char *tokenizer_data = reinterpret_cast<const char *>(tokenizer.data());
+    initialize(paths, std::vector<std::string_view>(paths.size()),
+               std::string_view(tokenizer_data, tokenizer.size()));
+}
+
+MoonshineModel::MoonshineModel(const ModelBuffers &buffers, const RuntimeOptions &options)
+    : env_(shared_env(options)),
+      options_(options),
+      memory_info_(Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU))
+{
+    std::cout << "Initializing Moonshine model from memory" << std::endl;
+    initialize({"preprocess.onnx", "encode.onnx", "uncached_decode.onnx", "cached_decode.onnx"},
+               {requireContents(buffers.preprocess, "preprocess.onnx"),
+                requireContents(buffers.encode, "encode.onnx"),
+                requireContents(buffers.uncached_decode, "uncached_decode.onnx"),
+                requireContents(buffers.cached_decode, "cached_decode.onnx")},
+               requireContents(buffers.tokenizer, "tokenizer.json"));
+}
+
+void MoonshineModel::initialize(const std::vector<std::string> &paths,
+                                const std::vector<std::string_view> &models,
+                                std::string_view tokenizer_content)
+{
+    registerSharedArena(*env_, options_);
+    const auto configs = sessionConfigs(options_);
+    const char *const model_names[] = {"preprocess", "encode", "uncached_decode", "cached_decode"};
+    if (options_.parallel_session_creation)
+    {
+        // Session creation is dominated by graph optimization, which is single-threaded per
+        // session, so the four models load concurrently
+        auto create = [this, &paths, &models, &configs, &model_names](size_t i)
+        {
+            return std::async(
+                std::launch::async,
+                [this, &paths, &models, &configs, &model_names, i]
+                { return createSession(model_names[i], paths[i], models[i], *configs[i]); });
+        };
+        auto preprocess = create(0);
+        auto encode = create(1);
+        auto uncached_decode = create(2);
+        auto cached_decode = create(3);
+        preprocess_ = preprocess.get();
+        encode_ = encode.get();
+        uncached_decode_ = uncached_decode.get();
+        cached_decode_ = cached_decode.get();
+    }
+    else
+    {
+        preprocess_ = createSession(model_names[0], paths[0], models[0], *configs[0]);
+        encode_ = createSession(model_names[1], paths[1], models[1], *configs[1]);
+        uncached_decode_ = createSession(model_names[2], paths[2], models[2], *configs[2]);
+        cached_decode_ = createSession(model_names[3], paths[3], models[3], *configs[3]);
+    }
+    validateSessions(paths);
+
+    if (tokenizer_content.empty())
+    {
+        throw std::runtime_error("Tokenizer is empty");
+    }
+    tokenizer_.load(tokenizer_content);
+
+    if (options_.use_vad)
+    {
+        vad_ = std::make_unique<VoiceActivityDetector>(options_.vad, env_);
+    }
+
+    for (float seconds : options_.length_buckets_seconds)
+    {
+        if (seconds > 0.0f)
+        {
+            bucket_samples_.push_back(static_cast<size_t>(seconds * 16000));
+        }
+    }
+    std::sort(bucket_samples_.begin(), bucket_samples_.end());
+    bucket_samples_.erase(std::unique(bucket_samples_.begin(), bucket_samples_.end()),
+                          bucket_samples_.end());
+    idle_encoder_buffers_.resize(bucket_samples_.size());
+
+    if (options_.warm_up)
+    {
+        warm_up();
+    }
+}
+
+void MoonshineModel::validateSessions(const std::vector<std::string> &paths) const
+{
+    const auto kFloat = ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT;
+    const auto kInt32 = ONNX_TENSOR_ELEMENT_DATA_TYPE_INT32;
+
+    // The KV caches are copied byte-wise in whatever type the decoders use
+    validateSession(*preprocess_, paths[0], expectedTensors(preprocess_input_names, {kFloat}),
+                    expectedTensors(preprocess_output_names, {kFloat}));
+    validateSession(*encode_, paths[1], expectedTensors(encode_input_names, {kFloat, kInt32}),
+                    expectedTensors(encode_ouput_names, {kFloat}));
+    validateSession(*uncached_decode_, paths[2],
+                    expectedTensors(decode_input_names, {kInt32, kFloat, kInt32}),
+                    expectedTensors(decode_output_names, {kFloat}));
+    validateSession(*cached_decode_, paths[3],
+                    expectedTensors(cached_decode_input_names, {kInt32, kFloat, kInt32}),
+                    expectedTensors(cached_decode_output_names, {kFloat}));
+}
+
+void MoonshineModel::warm_up()
+{
+    // One second of low-level noise over a tone, which decodes to a few tokens and so goes
+    // through both the uncached and the cached decoder
+    std::vector<float> audio(16000);
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < audio.size(); ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        const float noise = static_cast<float>(seed >> 8) / 16777216.0f - 0.5f;
+        audio[i] = 0.1f * std::sin(2.0f * 3.14159265f * 220.0f * i / 16000.0f) + 0.02f * noise;
+    }
+    generate(audio);
+}
+
+MoonshineModel::~MoonshineModel() = default;
+
+std::vector<std::string> MoonshineModel::end_profiling()
+{
+    std::vector<std::string> trace_files;
+    if (!options_.enable_profiling)
+    {
+        return trace_files;
+    }
+
+    Ort::AllocatorWithDefaultOptions allocator;
+    for (Ort::Session *session :
+         {preprocess_.get(), encode_.get(), uncached_decode_.get(), cached_decode_.get()})
+    {
+        trace_files.emplace_back(session->EndProfilingAllocated(allocator).get());
+    }
+    return trace_files;
+}
+
+std::shared_ptr<Ort::Env> MoonshineModel::shared_env(const RuntimeOptions &options)
+{
+    static std::mutex mutex;
+    static std::shared_ptr<Ort::Env> env;
+    static bool has_global_thread_pools = false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!env)
+    {
+        if (options.use_global_thread_pools)
+        {
+            Ort::ThreadingOptions threading_options;
+            threading_options.SetGlobalIntraOpNumThreads(options.intra_op_num_threads);
+            threading_options.SetGlobalInterOpNumThreads(options.inter_op_num_threads);
+            threading_options.SetGlobalSpinControl(options.allow_spinning ? 1 : 0);
+            const auto configs = sessionConfigs(options);
+            if (std::any_of(configs.begin(), configs.end(),
+                            [](const SessionConfig *config) { return config->flush_denormals; }))
+            {
+                threading_options.SetGlobalDenormalAsZero();
+            }
+            if (!options.intra_op_thread_affinity.empty())
+            {
+                Ort::ThrowOnError(Ort::GetApi().SetGlobalIntraOpThreadAffinity(
+                    threading_options, options.intra_op_thread_affinity.c_str()));
+            }
+            env = std::make_shared<Ort::Env>(threading_options, ORT_LOGGING_LEVEL_WARNING,
+                                             "MoonshineModel");
+            has_global_thread_pools = true;
+        }
+        else
+        {
+            env = std::make_shared<Ort::Env>(ORT_LOGGING_LEVEL_WARNING, "MoonshineModel");
+        }
+    }
+    else if (options.use_global_thread_pools && !has_global_thread_pools)
+    {
+        throw std::runtime_error(
+            "Global thread pools requested, but the shared Env was created without them; call "
+            "MoonshineModel::shared_env() with these options before creating any model or VAD");
+    }
+    return env;
+}
+
+std::unique_ptr<MoonshineModel::DecoderState> MoonshineModel::acquireDecoderState()
+{
+    {
+        std::lock_guard<std::mutex> lock(decoder_states_mutex_);
+        if (!idle_decoder_states_.empty())
+        {
+            std::unique_ptr<DecoderState> state = std::move(idle_decoder_states_.back());
+            idle_decoder_states_.pop_back();
+            return state;
+        }
+    }
+    return std::make_unique<DecoderState>(*uncached_decode_, *cached_decode_, memory_info_);
+}
+
+void MoonshineModel::releaseDecoderState(std::unique_ptr<DecoderState> state)
+{
+    std::lock_guard<std::mutex> lock(decoder_states_mutex_);
+    idle_decoder_states_.push_back(std::move(state));
+}
+
+std::shared_ptr<MoonshineModel::EncoderBuffers> MoonshineModel::acquireEncoderBuffers(
+    size_t bucket)
+{
+    std::unique_ptr<EncoderBuffers> buffers;
+    {
+        std::lock_guard<std::mutex> lock(encoder_buffers_mutex_);
+        auto &idle = idle_encoder_buffers_[bucket];
+        if (!idle.empty())
+        {
+            buffers = std::move(idle.back());
+            idle.pop_back();
+        }
+    }
+    if (!buffers)
+    {
+        buffers = std::make_unique<EncoderBuffers>(*preprocess_, *encode_, memory_info_,
+                                                   bucket_samples_[bucket]);
+    }
+
+    // Buffers whose last run failed are not reused, like decoder states
+    return std::shared_ptr<EncoderBuffers>(
+        buffers.release(),
+        [this, bucket](EncoderBuffers *released)
+        {
+            std::unique_ptr<EncoderBuffers> owned(released);
+            if (owned->reusable)
+            {
+                std::lock_guard<std::mutex> lock(encoder_buffers_mutex_);
+                idle_encoder_buffers_[bucket].push_back(std::move(owned));
+            }
+        });
+}
+
+std::unique_ptr<Ort::Session> MoonshineModel::createSession(const char *model,
+                                                            const std::string &model_path,
+                                                            std::string_view model_bytes,
+                                                            const SessionConfig &config)
+{
+    if (model_bytes.empty() && !std::filesystem::exists(model_path))
+    {
+        throw std::runtime_error("Model file not found: " + model_path);
+    }
+
+    const int intra_op_threads = config.intra_op_num_threads > 0
+                                     ? config.intra_op_num_threads
+                                     : options_.intra_op_num_threads;
+    const int inter_op_threads = config.inter_op_num_threads > 0
+                                     ? config.inter_op_num_threads
+                                     : options_.inter_op_num_threads;
+
+    Ort::SessionOptions session_options;
+    if (options_.use_global_thread_pools)
+    {
+        session_options.DisablePerSessionThreads();
+    }
+    else
+    {
+        const char *spinning = options_.allow_spinning ? "1" : "0";
+        session_options.SetIntraOpNumThreads(intra_op_threads);
+        session_options.SetInterOpNumThreads(inter_op_threads);
+        session_options.AddConfigEntry("session.intra_op.allow_spinning", spinning);
+        session_options.AddConfigEntry("session.inter_op.allow_spinning", spinning);
+        if (!options_.intra_op_thread_affinity.empty())
+        {
+            session_options.AddConfigEntry("session.intra_op_thread_affinities",
+                                           options_.intra_op_thread_affinity.c_str());
+        }
+    }
+    if (config.parallel_execution || inter_op_threads > 1)
+    {
+        session_options.SetExecutionMode(ExecutionMode::ORT_PARALLEL);
+    }
+    if (!config.enable_cpu_mem_arena)
+    {
+        session_options.DisableCpuMemArena();
+    }
+    if (!config.enable_mem_pattern)
+    {
+        session_options.DisableMemPattern();
+    }
+    if (config.flush_denormals)
+    {
+        session_options.AddConfigEntry("session.set_denormal_as_zero", "1");
+    }
+    if (config.use_shared_arena)
+    {
+        session_options.AddConfigEntry("session.use_env_allocators", "1");
+    }
+    for (const auto &[key, value] : config.config_entries)
+    {
+        session_options.AddConfigEntry(key.c_str(), value.c_str());
+    }
+    session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+
+    // Decoders rewritten by scripts/share_decoder_weights.py take their weights from the
+    // shared tensors, which ONNX Runtime packs once for all sessions given the same container
+    const std::vector<std::pair<std::string, size_t>> *shared = nullptr;
+    if (shared_weights_)
+    {
+        const auto found = shared_weights_->initializers.find(model);
+        if (found != shared_weights_->initializers.end())
+        {
+            shared = &found->second;
+        }
+    }
+    if (shared)
+    {
+        for (const auto &[name, index] : *shared)
+        {
+            session_options.AddInitializer(name.c_str(), shared_weights_->tensors[index]);
+        }
+        if (!model_bytes.empty())
+        {
+            // ONNX Runtime checks that the weights file exists before taking the initializers
+            // passed in, and a model loaded from memory has no directory to find it in
+            session_options.AddExternalInitializersFromFilesInMemory(
+                {ortPath(shared_weights_->weights_name)},
+                {const_cast<char *>(shared_weights_->weights.data())},
+                {shared_weights_->weights.size()});
+        }
+    }
+
+    // An optimized copy would hold the weights again instead of referencing the shared ones
+    std::filesystem::path load_path = model_path;
+    if (!options_.optimized_model_cache_dir.empty() && !shared)
+    {
+        load_path = optimizedModelPath(model_path, model_bytes, session_options);
+    }
+
+    // Added after the optimized copy is saved, which must only hold CPU kernels
+    if (config.use_xnnpack)
+    {
+        const auto providers = Ort::GetAvailableProviders();
+        if (std::find(providers.begin(), providers.end(), "XnnpackExecutionProvider") !=
+            providers.end())
+        {
+            const int threads = intra_op_threads > 0
+                                    ? intra_op_threads
+                                    : static_cast<int>(std::thread::hardware_concurrency());
+            if (!options_.use_global_thread_pools)
+            {
+                session_options.SetIntraOpNumThreads(1);
+            }
+            session_options.AppendExecutionProvider(
+                "XNNPACK", {{"intra_op_num_threads", std::to_string(threads)}});
+        }
+        else
+        {
+            std::cerr << "XNNPACK is not available in this ONNX Runtime build; running "
+                      << model_path << " on the default CPU provider" << std::endl;
+        }
+    }
+    if (options_.enable_profiling)
+    {
+        const std::string stem = std::filesystem::path(model_path).stem().string();
+        const auto profile_prefix = ortPath(options_.profile_prefix + "_" + stem);
+        session_options.EnableProfiling(profile_prefix.c_str());
+    }
+
+    if (!model_bytes.empty() && load_path == model_path)
+    {
+        if (shared)
+        {
+            return std::make_unique<Ort::Session>(*env_, model_bytes.data(), model_bytes.size(),
+                                                  session_options,
+                                                  shared_weights_->prepacked);
+        }
+        return std::make_unique<Ort::Session>(*env_, model_bytes.data(), model_bytes.size(),
+                                              session_options);
+    }
 
-    // Read tokenizer JSON as UTF-8
-    std::string tokenizer_content = readFileAsUtf8(models_dir + "/tokenizer.json");
-    load_tokenizer(tokenizer_content);
+    // Use the constructor with wide string path on Windows
+    const auto real_path = ortPath(load_path);
+    if (shared)
+    {
+        return std::make_unique<Ort::Session>(*env_, real_path.c_str(), session_options,
+                                              shared_weights_->prepacked);
+    }
+    return std::make_unique<Ort::Session>(*env_, real_path.c_str(), session_options);
 }
 
-std::unique_ptr<Ort::Session> MoonshineModel::createSession(const std::string &model_path)
+std::string MoonshineModel::optimizedModelPath(const std::string &model_path,
+                                               std::string_view model_bytes,
+                                               const Ort::SessionOptions &session_options)
 {
-    if (!std::filesystem::exists(model_path))
+    namespace fs = std::filesystem;
+
+    // The key covers the model contents and the ONNX Runtime version that optimized it
+    std::ostringstream name;
+    name << fs::path(model_path).stem().string() << "-" << std::hex << std::setw(16)
+         << std::setfill('0')
+         << (model_bytes.empty() ? hashFile(model_path) : hashBytes(model_bytes)) << "-ort"
+         << Ort::GetVersionString() << ".onnx";
+    const fs::path cache_dir(options_.optimized_model_cache_dir);
+    const fs::path cached_path = cache_dir / name.str();
+    if (fs::exists(cached_path))
     {
-        throw std::runtime_error("Model file not found: " + model_path);
+        return cached_path.string();
     }
 
-    Ort::SessionOptions session_options;
-    session_options.SetIntraOpNumThreads(1);
-    session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
-
-#ifdef _WIN32
-    // Convert wstring for Windows compatibility
-    const std::wstring real_path = std::filesystem::path(model_path).wstring();
-#else
-    const std::string real_path = std::filesystem::path(model_path);
-#endif
+    // Save the model at the extended level, whose optimizations do not depend on the CPU.
+    // Loading it at the configured level then only runs the cheap hardware-specific passes.
+    // The file is written under a temporary name and renamed into place, so that workers
+    // starting at the same time never load a partially written model.
+    fs::create_directories(cache_dir);
+    std::ostringstream suffix;
+    suffix << ".tmp" << std::hex << std::hash<std::thread::id>()(std::this_thread::get_id())
+           << std::chrono::steady_clock::now().time_since_epoch().count();
+    fs::path temp_path = cached_path;
+    temp_path += suffix.str();
+    {
+        Ort::SessionOptions optimize_options = session_options.Clone();
+        optimize_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_EXTENDED);
+        const auto real_temp_path = ortPath(temp_path);
+        optimize_options.SetOptimizedModelFilePath(real_temp_path.c_str());
+        if (model_bytes.empty())
+        {
+            const auto real_model_path = ortPath(model_path);
+            Ort::Session session(*env_, real_model_path.c_str(), optimize_options);
+        }
+        else
+        {
+            Ort::Session session(*env_, model_bytes.data(), model_bytes.size(), optimize_options);
+        }
+    }
 
-    // Use the constructor with wide string path
-    return std::make_unique<Ort::Session>(env_, real_path.c_str(), session_options);
+    std::error_code error;
+    fs::rename(temp_path, cached_path, error);
+    if (error)
+    {
+        // Another worker published the same model first
+        fs::remove(temp_path, error);
+    }
+    return cached_path.string();
 }
 
-std::vector<int32_t> MoonshineModel::generate(const std::vector<float> &audio_samples,
-                                              size_t max_len)
+std::vector<Ort::Value> MoonshineModel::encode(float *audio, size_t batch, size_t samples,
+                                               int32_t &seq_len,
+                                               const Ort::RunOptions &run_options,
+                                               GenerateStats *stats)
 {
     // Prepare input audio tensor
-    std::vector<int64_t> audio_shape = {1, static_cast<int64_t>(audio_samples.size())};
+    std::vector<int64_t> audio_shape = {static_cast<int64_t>(batch),
+                                        static_cast<int64_t>(samples)};
     Ort::Value audio_tensor = Ort::Value::CreateTensor<float>(
-        memory_info_, const_cast<float *>(audio_samples.data()), audio_samples.size(),
-        audio_shape.data(), audio_shape.size());
-
-    std::vector<Ort::AllocatedStringPtr> outputNames;
-    Ort::AllocatorWithDefaultOptions allocator;
-
-    std::vector<const char *> rawInputNames = {"args_0"};
-    std::vector<const char *> rawOutputNames = {"sequential"};
+        memory_info_, audio, batch * samples, audio_shape.data(), audio_shape.size());
 
     // Preprocess
+    auto start = std::chrono::steady_clock::now();
     std::vector<Ort::Value> preprocess_inputs;
     preprocess_inputs.push_back(std::move(audio_tensor));
     auto preprocessed =
-        preprocess_->Run(Ort::RunOptions{nullptr}, rawInputNames.data(), preprocess_inputs.data(),
-                         preprocess_inputs.size(), rawOutputNames.data(), 1);
+        preprocess_->Run(run_options, preprocess_input_names.data(), preprocess_inputs.data(),
+                         preprocess_inputs.size(), preprocess_output_names.data(), 1);
+    if (stats)
+    {
+        stats->preprocess_seconds += secondsSince(start);
+        stats->ort_allocated_bytes += tensorBytes(preprocessed);
+    }
 
     // print the shape of the output tensor
     auto shape = preprocessed[0].GetTensorTypeAndShapeInfo().GetShape();
 
     // Calculate sequence length
-    int32_t seq_len = (int32_t)shape[1];
+    seq_len = (int32_t)shape[1];
     const std::vector<int64_t> seq_len_shape = {1};
     Ort::Value seq_len_tensor = Ort::Value::CreateTensor<int32_t>(
         memory_info_, &seq_len, 1, seq_len_shape.data(), seq_len_shape.size());
@@ -128,134 +1678,726 @@ std::vector<int32_t> MoonshineModel::generate(const std::vector<float> &audio_sa
     encode_inputs.push_back(std::move(preprocessed[0]));
     encode_inputs.push_back(std::move(seq_len_tensor));
     // Encode
-    auto context =
-        encode_->Run(Ort::RunOptions{nullptr}, encode_input_names.data(), encode_inputs.data(),
-                     encode_inputs.size(), encode_ouput_names.data(), encode_ouput_names.size());
-
-    // copy context to avoid modifying the original context
-    auto context_shape = context[0].GetTensorTypeAndShapeInfo().GetShape();
-    Ort::Value context_copy =
-        Ort::Value::CreateTensor<float>(memory_info_, context[0].GetTensorMutableData<float>(),
-                                        context[0].GetTensorTypeAndShapeInfo().GetElementCount(),
-                                        context_shape.data(), context_shape.size());
-
-    // Initial token
-    std::vector<int32_t> tokens = {1};  // Start token
-    std::vector<int64_t> input_shape = {1, 1};
-    Ort::Value inputs_tensor = Ort::Value::CreateTensor<int32_t>(
-        memory_info_, tokens.data(), tokens.size(), input_shape.data(), input_shape.size());
-
-    // Calculate max_len if not provided
-    if (max_len == 0)
+    start = std::chrono::steady_clock::now();
+    auto encoded = encode_->Run(run_options, encode_input_names.data(), encode_inputs.data(),
+                                encode_inputs.size(), encode_ouput_names.data(),
+                                encode_ouput_names.size());
+    if (stats)
     {
-        max_len = static_cast<size_t>((audio_samples.size() / 16000.0) * 6);
+        stats->encode_seconds += secondsSince(start);
+        stats->ort_allocated_bytes += tensorBytes(encoded);
     }
+    return encoded;
+}
+
+std::vector<int32_t> MoonshineModel::generate(const std::vector<float> &audio_samples,
+                                              size_t max_len)
+{
+    return generate(audio_samples.data(), audio_samples.size(), max_len);
+}
 
-    seq_len_tensor = Ort::Value::CreateTensor<int32_t>(memory_info_, &seq_len, 1,
-                                                       seq_len_shape.data(), seq_len_shape.size());
+std::vector<int32_t> MoonshineModel::generate(const float *audio_samples, size_t sample_count,
+                                              size_t max_len)
+{
+    GenerateOptions options;
+    options.max_len = max_len;
+    return generate(audio_samples, sample_count, options).tokens;
+}
 
-    std::vector<Ort::Value> uncached_decode_inputs;
-    uncached_decode_inputs.reserve(3);  // Reserve space for the inputs
-    uncached_decode_inputs.push_back(std::move(inputs_tensor));
-    uncached_decode_inputs.push_back(std::move(context_copy));
-    uncached_decode_inputs.push_back(std::move(seq_len_tensor));
+GenerateResult MoonshineModel::generate(const float *audio_samples, size_t sample_count,
+                                        const GenerateOptions &options)
+{
+    std::shared_ptr<EncodedRequest> request = encodeRequest(audio_samples, sample_count, options);
+    return decodeRequest(*request);
+}
 
-    // Initial uncached decode
-    auto cache =
-        uncached_decode_->Run(Ort::RunOptions{nullptr}, decode_input_names.data(),
-                              uncached_decode_inputs.data(), uncached_decode_inputs.size(),
-                              decode_output_names.data(), uncached_decode_->GetOutputCount());
+std::shared_ptr<MoonshineModel::EncodedRequest> MoonshineModel::encodeRequest(
+    const float *audio_samples, size_t sample_count, const GenerateOptions &options)
+{
+    auto request = std::make_shared<EncodedRequest>(options, tokenizer_);
+    GenerateCall &call = request->call;
+    GenerateStats *stats = options.stats;
+    if (stats)
+    {
+        *stats = GenerateStats();
+        stats->audio_seconds = sample_count / 16000.0;
+    }
 
-    // Generate tokens
-    for (size_t i = 0; i < max_len; ++i)
+    // With VAD only the speech is encoded, one segment at a time
+    std::vector<SpeechSegment> segments;
+    if (vad_)
+    {
+        segments = vad_->detect(audio_samples, sample_count);
+        if (stats)
+        {
+            stats->vad_seconds = secondsSince(call.start);
+        }
+    }
+    else
     {
-        float *logits_data = cache[0].GetTensorMutableData<float>();
-        size_t logits_size = cache[0].GetTensorTypeAndShapeInfo().GetElementCount();
+        segments.push_back({0, sample_count});
+    }
 
-        // Find argmax
-        int32_t next_token = 0;
-        float max_val = logits_data[0];
-        for (size_t j = 1; j < logits_size; ++j)
+    try
+    {
+        for (const auto &segment : segments)
         {
-            if (logits_data[j] > max_val)
+            EncodedSegment encoded;
+            encoded.sample_count = segment.end - segment.start;
+
+            // Pad to the smallest bucket that fits, if any
+            const size_t bucket = std::lower_bound(bucket_samples_.begin(), bucket_samples_.end(),
+                                                   encoded.sample_count) -
+                                  bucket_samples_.begin();
+            if (bucket < bucket_samples_.size())
             {
-                max_val = logits_data[j];
-                next_token = static_cast<int32_t>(j);
+                encoded.buffers = acquireEncoderBuffers(bucket);
+                encoded.context.push_back(
+                    encoded.buffers->run(audio_samples + segment.start, encoded.sample_count,
+                                         call.run_options, stats, encoded.seq_len));
             }
+            else
+            {
+                encoded.context = encode(const_cast<float *>(audio_samples + segment.start), 1,
+                                         encoded.sample_count, encoded.seq_len,
+                                         call.run_options, stats);
+            }
+            request->segments.push_back(std::move(encoded));
+        }
+    }
+    catch (const Ort::Exception &)
+    {
+        // A terminated run fails; the segments encoded before it are still decoded
+        if (!call.cancelled())
+        {
+            throw;
+        }
+        call.stop_reason = StopReason::Cancelled;
+    }
+    return request;
+}
+
+GenerateResult MoonshineModel::decodeRequest(EncodedRequest &request)
+{
+    GenerateCall &call = request.call;
+    GenerateResult result;
+    result.tokens = {1};  // Start token
+    if (call.options.log_probs)
+    {
+        result.log_probs = {0.0f};
+    }
+    float end_log_prob = 0.0f;
+    for (auto &segment : request.segments)
+    {
+        if (call.pastDeadline())
+        {
+            break;
         }
 
-        tokens.push_back(next_token);
-        if (next_token == 2) break;  // End token
+        // Calculate max_len if not provided
+        size_t max_len = call.options.max_len;
+        if (max_len == 0)
+        {
+            max_len = static_cast<size_t>((segment.sample_count / 16000.0) *
+                                          call.options.max_tokens_per_second);
+        }
 
-        // Update sequence length
-        seq_len++;
-        seq_len_tensor = Ort::Value::CreateTensor<int32_t>(
-            memory_info_, &seq_len, 1, seq_len_shape.data(), seq_len_shape.size());
+        std::vector<std::vector<int32_t>> segment_tokens = {{1}};  // Start token
+        segment_tokens[0].reserve(max_len + 1);
+        call.log_probs.clear();
+        try
+        {
+            if (call.options.beam_width > 1)
+            {
+                decodeBeams(segment.context[0], segment.seq_len, max_len, segment_tokens[0],
+                            call);
+            }
+            else
+            {
+                decode(segment.context[0], segment.seq_len, {max_len}, segment_tokens,
+                       call.run_options, &call);
+            }
+        }
+        catch (const Ort::Exception &)
+        {
+            // A terminated run fails; keep the tokens produced before it
+            if (!call.cancelled())
+            {
+                throw;
+            }
+            call.stop_reason = StopReason::Cancelled;
+        }
+        segment.context.clear();
+        segment.buffers.reset();
 
-        // Prepare next input
-        std::vector<int32_t> next_input = {next_token};
-        inputs_tensor = Ort::Value::CreateTensor<int32_t>(memory_info_, next_input.data(), 1,
-                                                          input_shape.data(), input_shape.size());
+        const auto &segment_text = segment_tokens[0];
+        const bool ended = segment_text.back() == 2;
+        result.tokens.insert(result.tokens.end(), segment_text.begin() + 1,
+                             segment_text.end() - (ended ? 1 : 0));
+        if (call.options.log_probs)
+        {
+            // One log probability per generated token, so without the start token
+            const size_t kept = segment_text.size() - 1 - (ended ? 1 : 0);
+            result.log_probs.insert(result.log_probs.end(), call.log_probs.begin(),
+                                    call.log_probs.begin() + kept);
+            if (ended)
+            {
+                end_log_prob = call.log_probs[kept];
+            }
+        }
+        if (call.stop_reason == StopReason::Callback || call.stop_reason == StopReason::Cancelled ||
+            call.stop_reason == StopReason::Deadline)
+        {
+            break;
+        }
+    }
 
-        context_copy = Ort::Value::CreateTensor<float>(
-            memory_info_, context[0].GetTensorMutableData<float>(),
-            context[0].GetTensorTypeAndShapeInfo().GetElementCount(), context_shape.data(),
-            context_shape.size());
+    result.stop_reason = call.stop_reason;
+    if (result.stop_reason == StopReason::EndToken)
+    {
+        result.tokens.push_back(2);  // End token
+        if (call.options.log_probs)
+        {
+            result.log_probs.push_back(end_log_prob);
+        }
+    }
 
-        // Run cached decode
-        std::vector<Ort::Value> cached_inputs;
-        cached_inputs.push_back(std::move(inputs_tensor));
-        cached_inputs.push_back(std::move(context_copy));
-        cached_inputs.push_back(std::move(seq_len_tensor));
-        for (size_t j = 1; j < cache.size(); ++j)
+    GenerateStats *stats = call.options.stats;
+    if (stats)
+    {
+        stats->total_seconds = secondsSince(call.start);
+        stats->token_count = result.tokens.size() - 1;
+        if (stats->audio_seconds > 0.0)
         {
-            cached_inputs.push_back(std::move(cache[j]));
+            stats->real_time_factor = stats->total_seconds / stats->audio_seconds;
         }
+    }
+    return result;
+}
+
+std::vector<std::vector<int32_t>> MoonshineModel::generate_batch(
+    const std::vector<std::vector<float>> &audio_batch, size_t max_len)
+{
+    if (audio_batch.empty())
+    {
+        return {};
+    }
+
+    // Pad every utterance with trailing silence up to the longest one
+    size_t samples = 0;
+    for (const auto &audio : audio_batch)
+    {
+        samples = std::max(samples, audio.size());
+    }
+    std::vector<float> padded(audio_batch.size() * samples, 0.0f);
+    for (size_t b = 0; b < audio_batch.size(); ++b)
+    {
+        std::copy(audio_batch[b].begin(), audio_batch[b].end(), padded.begin() + b * samples);
+    }
 
-        cache = cached_decode_->Run(Ort::RunOptions{nullptr}, cached_decode_input_names.data(),
-                                    cached_inputs.data(), cached_inputs.size(),
-                                    cached_decode_output_names.data(),
-                                    cached_decode_->GetOutputCount());
+    int32_t seq_len = 0;
+    const Ort::RunOptions run_options{nullptr};
+    auto context = encode(padded.data(), audio_batch.size(), samples, seq_len, run_options);
+
+    // Each sequence gets a token budget for its own, unpadded length, at the rate generate()
+    // uses by default, so a clip is truncated at the same length either way
+    const float tokens_per_second = GenerateOptions().max_tokens_per_second;
+    std::vector<size_t> max_lens(audio_batch.size(), max_len);
+    std::vector<std::vector<int32_t>> tokens(audio_batch.size());
+    for (size_t b = 0; b < audio_batch.size(); ++b)
+    {
+        if (max_len == 0)
+        {
+            max_lens[b] =
+                static_cast<size_t>((audio_batch[b].size() / 16000.0) * tokens_per_second);
+        }
+        tokens[b].reserve(max_lens[b] + 1);
+        tokens[b].push_back(1);  // Start token
     }
 
+    decode(context[0], seq_len, max_lens, tokens, run_options);
     return tokens;
 }
 
-void MoonshineModel::load_tokenizer(const std::string &tokenizer_content)
+std::vector<int32_t> MoonshineModel::transcribe_long(const std::vector<float> &audio_samples,
+                                                     const LongFormOptions &options)
 {
-    nlohmann::json tokenizer = nlohmann::json::parse(tokenizer_content);
+    const size_t chunk = static_cast<size_t>(options.chunk_seconds * 16000);
+    const size_t overlap = static_cast<size_t>(options.overlap_seconds * 16000);
+    const size_t search = std::min(static_cast<size_t>(options.boundary_search_seconds * 16000),
+                                   chunk / 2);
+    if (chunk <= overlap)
+    {
+        throw std::runtime_error("chunk_seconds must be longer than overlap_seconds");
+    }
+    if (audio_samples.size() <= chunk + search)
+    {
+        return generate(audio_samples);
+    }
+
+    // Cut at the quietest point near every multiple of the chunk length
+    std::vector<size_t> cuts = {0};
+    while (audio_samples.size() - cuts.back() > chunk + search)
+    {
+        const size_t target = cuts.back() + chunk;
+        const size_t begin = std::max(target - search, cuts.back() + overlap + 1);
+        cuts.push_back(quietestPoint(audio_samples.data(), begin, target + search));
+    }
+    cuts.push_back(audio_samples.size());
+
+    // Decode the chunks on a pool of workers, each chunk starting overlap samples early
+    const size_t chunk_count = cuts.size() - 1;
+    std::vector<std::vector<int32_t>> chunk_tokens(chunk_count);
+    std::atomic<size_t> next_chunk{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto worker = [&]()
+    {
+        for (size_t c = next_chunk++; c < chunk_count; c = next_chunk++)
+        {
+            try
+            {
+                const size_t start = c == 0 ? 0 : cuts[c] - overlap;
+                chunk_tokens[c] = generate(audio_samples.data() + start, cuts[c + 1] - start);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+                next_chunk = chunk_count;
+            }
+        }
+    };
+
+    size_t thread_count = options.num_threads;
+    if (thread_count == 0)
+    {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    thread_count = std::min(thread_count, chunk_count);
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < thread_count; ++t)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+
+    // Join the chunks without their start and end tokens, matching tokens in the overlaps
+    // over a window of twice the tokens the overlap could hold at the usual rate
+    const size_t window = std::max<size_t>(8, static_cast<size_t>(options.overlap_seconds * 12));
+    std::vector<int32_t> merged;
+    bool ended = true;
+    for (const auto &tokens : chunk_tokens)
+    {
+        ended = tokens.back() == 2;
+        std::vector<int32_t> text(tokens.begin() + 1, tokens.end() - (ended ? 1 : 0));
+        mergeOverlap(merged, text, window);
+    }
 
-    // Create token ID to token map
-    for (const auto &item : tokenizer["model"]["vocab"].items())
+    std::vector<int32_t> result = {1};  // Start token
+    result.insert(result.end(), merged.begin(), merged.end());
+    if (ended)
     {
-        token_id_to_token_[item.value()] = item.key();
+        result.push_back(2);  // End token
     }
+    return result;
 }
 
-std::string MoonshineModel::detokenize(const std::vector<int> &tokens)
+void MoonshineModel::decode(Ort::Value &context, int32_t seq_len,
+                            const std::vector<size_t> &max_lens,
+                            std::vector<std::vector<int32_t>> &tokens,
+                            const Ort::RunOptions &run_options, GenerateCall *call)
 {
-    std::string result;
-    for (const auto &token : tokens)
+    // Each in-flight call decodes with its own state. A state is not returned to the pool
+    // if a step throws, so a half-updated one is never reused.
+    std::unique_ptr<DecoderState> owned_state = acquireDecoderState();
+    DecoderState &state = *owned_state;
+    const size_t batch = tokens.size();
+    const size_t capacity = *std::max_element(max_lens.begin(), max_lens.end());
+
+    // Token, context and seq_len are bound once per utterance; the loop only rewrites the
+    // values behind them, and rebinds them when finished sequences are dropped.
+    state.context_data = context.GetTensorMutableData<float>();
+    state.context_shape = context.GetTensorTypeAndShapeInfo().GetShape();
+    state.seq_len = seq_len;
+    state.max_rows = batch;
+    state.resizeBatch(batch);
+    state.active.resize(batch);
+    for (size_t b = 0; b < batch; ++b)
+    {
+        state.active[b] = b;
+        state.tokens[b] = tokens[b].back();
+    }
+
+    // Initial uncached decode, once per utterance, into ORT-allocated outputs
+    GenerateStats *stats = call ? call->options.stats : nullptr;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Ort::Value> first = state.runUncached(capacity, run_options);
+    if (stats)
+    {
+        stats->uncached_decode_seconds += secondsSince(start);
+        stats->ort_allocated_bytes += tensorBytes(first);
+    }
+    float *logits_data = first[0].GetTensorMutableData<float>();
+    const size_t vocab_size = elementCount(state.logits_shape) / batch;
+
+    // Generate tokens
+    while (true)
     {
-        if (token_id_to_token_.find(token) != token_id_to_token_.end())
+        state.keep.clear();
+        for (size_t row = 0; row < state.active.size(); ++row)
         {
-            std::string token_str = token_id_to_token_.at(token);
-            // Remove the '▁' prefix if it exists and add actual space
-            if (!token_str.empty() && (unsigned char)token_str[0] == 0xE2)
+            const size_t seq = state.active[row];
+            if (tokens[seq].size() - 1 >= max_lens[seq])
+            {
+                if (call) call->stop_reason = StopReason::MaxLength;
+                continue;
+            }
+
+            // Calls mask suppressed tokens in place; the next step overwrites the logits
+            float *row_logits = logits_data + row * vocab_size;
+            TokenChoice choice;
+            if (call && !call->options.suppress_tokens.empty())
+            {
+                suppressTokens(row_logits, vocab_size, call->options.suppress_tokens);
+            }
+            if (call && call->options.log_probs)
             {
-                // The '▁' character is E2 96 81 in UTF-8
-                result += " " + token_str.substr(3);  // Skip the 3 bytes of '▁'
+                choice = selectToken(row_logits, vocab_size);
+                call->log_probs.push_back(choice.log_prob);
             }
             else
             {
-                result += token_str;
+                choice.token = argmaxLogits(row_logits, vocab_size);
+            }
+            const int32_t next_token = choice.token;
+            tokens[seq].push_back(next_token);
+            if (next_token == 2)  // End token
+            {
+                if (call) call->stop_reason = StopReason::EndToken;
+                continue;
+            }
+            if (call && call->options.on_token && !reportToken(*call, next_token, choice.log_prob))
+            {
+                call->stop_reason = StopReason::Callback;
+                continue;
+            }
+            if (call && call->stopsAfter(tokens[seq], call->stop_reason))
+            {
+                continue;
+            }
+            if (tokens[seq].size() - 1 >= max_lens[seq])  // Logits would be unused
+            {
+                if (call) call->stop_reason = StopReason::MaxLength;
+                continue;
+            }
+
+            state.tokens[state.keep.size()] = next_token;
+            state.keep.push_back(row);
+        }
+        if (state.keep.empty()) break;
+        if (call && call->cancelled())
+        {
+            call->stop_reason = StopReason::Cancelled;
+            break;
+        }
+        if (call && call->pastDeadline())
+        {
+            break;
+        }
+
+        if (state.keep.size() != state.active.size())
+        {
+            // Retire finished sequences by dropping their rows from the cache and context
+            state.selectRows(state.keep);
+            const size_t row_size = elementCount(state.context_shape) / state.active.size();
+            for (size_t k = 0; k < state.keep.size(); ++k)
+            {
+                if (state.keep[k] != k)
+                {
+                    std::memmove(state.context_data + k * row_size,
+                                 state.context_data + state.keep[k] * row_size,
+                                 row_size * sizeof(float));
+                }
+                state.active[k] = state.active[state.keep[k]];
             }
+            state.active.resize(state.keep.size());
+            state.resizeBatch(state.keep.size());
+        }
+
+        // Run cached decode
+        state.seq_len++;
+        start = std::chrono::steady_clock::now();
+        const size_t allocated_bytes = state.runCached(capacity, run_options);
+        if (stats)
+        {
+            stats->cached_decode_seconds.push_back(secondsSince(start));
+            stats->ort_allocated_bytes += allocated_bytes;
         }
+        logits_data = state.logits.data();
     }
-    // Trim leading space if exists
-    if (!result.empty() && result[0] == ' ')
+
+    releaseDecoderState(std::move(owned_state));
+}
+
+void MoonshineModel::decodeBeams(Ort::Value &context, int32_t seq_len, size_t max_len,
+                                 std::vector<int32_t> &tokens, GenerateCall &call)
+{
+    if (max_len == 0)
     {
-        result = result.substr(1);
+        call.stop_reason = StopReason::MaxLength;
+        return;
     }
-    return result;
+    const size_t width = call.options.beam_width;
+    std::unique_ptr<DecoderState> owned_state = acquireDecoderState();
+    DecoderState &state = *owned_state;
+
+    // The first step runs on the single context row and seeds the beams
+    state.context_data = context.GetTensorMutableData<float>();
+    state.context_shape = context.GetTensorTypeAndShapeInfo().GetShape();
+    state.seq_len = seq_len;
+    state.max_rows = width;
+    state.resizeBatch(1);
+    state.active = {0};
+    state.tokens[0] = tokens.back();
+
+    GenerateStats *stats = call.options.stats;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Ort::Value> first = state.runUncached(max_len, call.run_options);
+    if (stats)
+    {
+        stats->uncached_decode_seconds += secondsSince(start);
+        stats->ort_allocated_bytes += tensorBytes(first);
+    }
+    float *logits_data = first[0].GetTensorMutableData<float>();
+    const size_t vocab_size = elementCount(state.logits_shape);
+
+    // Every beam attends to the same context, so it is repeated once for the whole search
+    const size_t row_size = elementCount(state.context_shape);
+    state.beam_context.resize(row_size * width);
+    for (size_t b = 0; b < width; ++b)
+    {
+        std::memcpy(state.beam_context.data() + b * row_size, state.context_data,
+                    row_size * sizeof(float));
+    }
+    state.context_data = state.beam_context.data();
+
+    std::vector<BeamHypothesis> beams(1);
+    beams[0].tokens = tokens;
+    std::vector<BeamHypothesis> next;
+    std::vector<BeamHypothesis> finished;
+    std::vector<BeamCandidate> candidates;
+    std::vector<TokenScore> top(width);
+    bool interrupted = false;
+    bool reusable = true;
+    while (true)
+    {
+        // Expand each beam by its best tokens; no other token can make the overall top width
+        candidates.clear();
+        for (size_t row = 0; row < beams.size(); ++row)
+        {
+            float *row_logits = logits_data + row * vocab_size;
+            suppressTokens(row_logits, vocab_size, call.options.suppress_tokens);
+            const float log_sum = logSumExp(row_logits, vocab_size);
+            const size_t count = topK(row_logits, vocab_size, width, top.data());
+            for (size_t c = 0; c < count; ++c)
+            {
+                const float log_prob = top[c].logit - log_sum;
+                candidates.push_back({row, top[c].token, log_prob, beams[row].score + log_prob});
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(),
+                  [](const BeamCandidate &a, const BeamCandidate &b)
+                  {
+                      if (a.score != b.score) return a.score > b.score;
+                      if (a.beam != b.beam) return a.beam < b.beam;
+                      return a.token < b.token;
+                  });
+
+        next.clear();
+        state.keep.clear();
+        for (size_t rank = 0; rank < candidates.size() && next.size() < width; ++rank)
+        {
+            const BeamCandidate &candidate = candidates[rank];
+            BeamHypothesis hypothesis = beams[candidate.beam];
+            hypothesis.tokens.push_back(candidate.token);
+            hypothesis.log_probs.push_back(candidate.log_prob);
+            hypothesis.score = candidate.score;
+            if (candidate.token == 2)  // End token
+            {
+                // Only endings that rank among the best width candidates count
+                if (rank < width)
+                {
+                    hypothesis.reason = StopReason::EndToken;
+                    finished.push_back(std::move(hypothesis));
+                }
+                continue;
+            }
+            if (call.stopsAfter(hypothesis.tokens, hypothesis.reason))
+            {
+                finished.push_back(std::move(hypothesis));
+                continue;
+            }
+            if (hypothesis.tokens.size() - 1 >= max_len)
+            {
+                hypothesis.reason = StopReason::MaxLength;
+                finished.push_back(std::move(hypothesis));
+                continue;
+            }
+            state.keep.push_back(candidate.beam);
+            next.push_back(std::move(hypothesis));
+        }
+        beams.swap(next);
+        if (beams.empty() || finished.size() >= width)
+        {
+            break;
+        }
+        if (call.cancelled())
+        {
+            call.stop_reason = StopReason::Cancelled;
+            interrupted = true;
+            break;
+        }
+        if (call.pastDeadline())
+        {
+            interrupted = true;
+            break;
+        }
+
+        // Gather the cache rows of each surviving beam's parent. The gather writes into the
+        // idle half of the ping-pong buffers, so a parent can be copied to several rows.
+        state.selectRows(state.keep);
+        state.resizeBatch(beams.size());
+        for (size_t b = 0; b < beams.size(); ++b)
+        {
+            state.tokens[b] = beams[b].tokens.back();
+        }
+
+        state.seq_len++;
+        start = std::chrono::steady_clock::now();
+        try
+        {
+            const size_t allocated_bytes = state.runCached(max_len, call.run_options);
+            if (stats)
+            {
+                stats->cached_decode_seconds.push_back(secondsSince(start));
+                stats->ort_allocated_bytes += allocated_bytes;
+            }
+        }
+        catch (const Ort::Exception &)
+        {
+            // A terminated run fails; rank the beams of the previous step instead
+            if (!call.cancelled())
+            {
+                throw;
+            }
+            call.stop_reason = StopReason::Cancelled;
+            interrupted = true;
+            reusable = false;
+            break;
+        }
+        logits_data = state.logits.data();
+    }
+    if (reusable)
+    {
+        releaseDecoderState(std::move(owned_state));
+    }
+
+    // Rank by length-normalized score; an interrupted search also considers the live beams
+    if (interrupted || finished.empty())
+    {
+        for (auto &beam : beams)
+        {
+            finished.push_back(std::move(beam));
+        }
+    }
+    const float penalty = call.options.beam_length_penalty;
+    auto normalized = [penalty](const BeamHypothesis &hypothesis)
+    {
+        const float length = static_cast<float>(std::max<size_t>(1, hypothesis.log_probs.size()));
+        return hypothesis.score / std::pow(length, penalty);
+    };
+    const BeamHypothesis *best = nullptr;
+    for (const auto &hypothesis : finished)
+    {
+        if (!best || normalized(hypothesis) > normalized(*best))
+        {
+            best = &hypothesis;
+        }
+    }
+    if (!best)
+    {
+        return;
+    }
+    if (!interrupted)
+    {
+        call.stop_reason = best->reason;
+    }
+    tokens = best->tokens;
+    call.log_probs = best->log_probs;
+
+    // Stream the result to the callback, which may still cut it short
+    if (call.options.on_token)
+    {
+        for (size_t i = 1; i < tokens.size(); ++i)
+        {
+            if (tokens[i] == 2)
+            {
+                break;
+            }
+            if (!reportToken(call, tokens[i], call.log_probs[i - 1]))
+            {
+                tokens.resize(i + 1);
+                call.log_probs.resize(i);
+                call.stop_reason = StopReason::Callback;
+                break;
+            }
+        }
+    }
+}
+
+bool MoonshineModel::reportToken(GenerateCall &call, int32_t token, float log_prob)
+{
+    const auto now = std::chrono::steady_clock::now();
+    GeneratedToken generated;
+    generated.token = token;
+    generated.text = call.detokenizer.push(token);
+    generated.step_seconds = std::chrono::duration<double>(now - call.last_token).count();
+    generated.elapsed_seconds = std::chrono::duration<double>(now - call.start).count();
+    generated.log_prob = log_prob;
+    call.last_token = now;
+    return call.options.on_token(generated);
+}
+
+std::string MoonshineModel::detokenize(const std::vector<int32_t> &tokens) const
+{
+    std::string text;
+    detokenize(tokens, text);
+    return text;
+}
+
+void MoonshineModel::detokenize(const std::vector<int32_t> &tokens, std::string &text) const
+{
+    tokenizer_.detokenize(tokens.data(), tokens.size(), text);
+}
+
+const Tokenizer &MoonshineModel::tokenizer() const
+{
+    return tokenizer_;
+}
+
+std::shared_ptr<Ort::Env> MoonshineModel::env() const
+{
+    return env_;
 }
@@ -1,23 +1,479 @@
 // moonshine.hpp
 #pragma once
 #include <onnxruntime_cxx_api.h>
+#include "tokenizer.hpp"
+#include "vad.hpp"
 #include <vector>
 #include <string>
+#include <string_view>
 #include <memory>
-#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <utility>
+
+/**
+ * @enum ModelPrecision
+ * @brief Numeric precision of a model file, which selects the file loaded from the models
+ * directory.
+ */
+enum class ModelPrecision
+{
+    Fp32,  ///< <name>.onnx, the exported float model.
+    Fp16,  ///< <name>_fp16.onnx, float16 weights with float32 inputs and outputs.
+    Int8   ///< <name>_int8.onnx, weights quantized to int8 with dynamic activation scales.
+};
+
+/**
+ * @struct ModelPrecisions
+ * @brief The precision of each model of a MoonshineModel.
+ *
+ * The token loop is bound by reading the decoder weights, so int8 decoders save the most
+ * time; the preprocessing convolutions are the most sensitive to quantization.
+ */
+struct ModelPrecisions
+{
+    ModelPrecision preprocess = ModelPrecision::Fp32;  ///< The preprocessing model.
+    ModelPrecision encode = ModelPrecision::Fp32;      ///< The encoder.
+    ModelPrecision decode = ModelPrecision::Fp32;      ///< Both decoders, which share weights.
+};
+
+/**
+ * @brief Parse a precision specification.
+ *
+ * "fp32", "fp16" and "int8" apply to every model, "mixed" is int8 decoders with the other
+ * models in fp32, and a list such as "encode=int8,decode=int8" sets single models, leaving
+ * the others in fp32.
+ *
+ * @param spec The specification.
+ * @return The precision of each model.
+ * @throws std::runtime_error if the specification is not understood.
+ */
+ModelPrecisions parseModelPrecisions(const std::string &spec);
+
+/**
+ * @struct SessionConfig
+ * @brief ONNX Runtime settings of one of the sessions of a MoonshineModel.
+ *
+ * The encoder runs a few large operators once per utterance, while the decoders run many
+ * small ones per token, where allocator and scheduling overhead weigh more; the best
+ * settings therefore differ between them.
+ */
+struct SessionConfig
+{
+    /// Intra-op threads of this session; 0 uses RuntimeOptions::intra_op_num_threads.
+    /// Ignored with global thread pools.
+    int intra_op_num_threads = 0;
+
+    /// Inter-op threads of this session; 0 uses RuntimeOptions::inter_op_num_threads.
+    /// Ignored with global thread pools.
+    int inter_op_num_threads = 0;
+
+    /// Run independent operators concurrently on the inter-op pool. Sessions with more
+    /// than one inter-op thread always do.
+    bool parallel_execution = false;
+
+    /// Allocate intermediate tensors from a growing arena instead of the system heap.
+    bool enable_cpu_mem_arena = true;
+
+    /// Plan the memory of a run from earlier runs with the same input shapes and allocate
+    /// it as one block. Pays off when shapes repeat, e.g. with length buckets.
+    bool enable_mem_pattern = true;
+
+    /// Flush denormal floats to zero on the threads running the session, which avoids slow
+    /// paths on x86 at a negligible accuracy cost. With global thread pools, setting it on
+    /// any session enables it on the shared pools.
+    bool flush_denormals = false;
+
+    /// Run supported operators with the XNNPACK execution provider if ONNX Runtime was
+    /// built with it, and warn otherwise. XNNPACK gets the session's intra-op threads as a
+    /// pool of its own, and the intra-op pool of the session is reduced to one thread.
+    bool use_xnnpack = false;
+
+    /// Allocate from the arena registered with the shared Env instead of an arena of the
+    /// session's own, so that sessions and models draw from one pool of memory. See
+    /// RuntimeOptions::shared_arena.
+    bool use_shared_arena = false;
+
+    /// Further ONNX Runtime session configuration entries, applied after the settings above
+    /// so that they take precedence.
+    std::vector<std::pair<std::string, std::string>> config_entries;
+};
+
+/**
+ * @struct ArenaConfig
+ * @brief Settings of the CPU arena allocator registered with the shared Env.
+ *
+ * Negative values keep the ONNX Runtime defaults.
+ */
+struct ArenaConfig
+{
+    size_t max_memory = 0;              ///< Most bytes the arena may hold; 0 is unlimited.
+    int extend_strategy = -1;           ///< 0 doubles every extension, 1 grows by request.
+    int initial_chunk_size_bytes = -1;  ///< Size of the first chunk.
+    int max_dead_bytes_per_chunk = -1;  ///< Unused bytes above which a chunk is split.
+};
+
+/**
+ * @struct RuntimeOptions
+ * @brief Threading configuration for the ONNX Runtime sessions of a MoonshineModel.
+ */
+struct RuntimeOptions
+{
+    /// Threads used inside a single operator. 0 lets ONNX Runtime use one per core.
+    int intra_op_num_threads = 1;
+
+    /// Threads used to run independent operators concurrently. Values above 1 switch the
+    /// sessions to parallel execution.
+    int inter_op_num_threads = 1;
+
+    /// Whether idle pool threads spin before sleeping. Spinning lowers latency at the cost
+    /// of CPU time, which matters when several models share the cores.
+    bool allow_spinning = true;
+
+    /// ONNX Runtime affinity string for the intra-op threads, e.g. "1;2;3" pins the three
+    /// extra threads of a 4-thread pool to logical processors 1-3. Empty leaves them unpinned.
+    std::string intra_op_thread_affinity;
+
+    /// Run every session on the thread pools of the process-wide Env instead of creating
+    /// pools per session. The pools are sized by the options of the first model that
+    /// creates the shared Env; see MoonshineModel::shared_env().
+    bool use_global_thread_pools = false;
+
+    /// Lengths in seconds that single utterances are padded up to with trailing silence
+    /// before preprocessing and encoding. The encoder then only sees a few input shapes, so
+    /// ONNX Runtime reuses its memory plans and each bucket keeps bound buffers across calls.
+    /// The decoder only attends to the frames of the real audio. Longer audio is encoded at
+    /// its own length. Empty, the default, disables bucketing.
+    ///
+    /// The encoder has no attention mask, so its self-attention also sees the padding, and
+    /// the frames of the real audio come out slightly different than without it. Transcripts
+    /// can change, mostly in the last words before the padding, and more so the more of a
+    /// bucket is silence. Check the token error rate on your own audio before enabling it,
+    /// e.g. by comparing transcripts with and without buckets, and keep buckets close together.
+    std::vector<float> length_buckets_seconds;
+
+    /// Create the four sessions concurrently instead of one after another.
+    bool parallel_session_creation = true;
+
+    /// Register the decoder weights as initializers shared by both decoder sessions and by
+    /// every model in the process loaded from the same files. This needs decoder_weights.json
+    /// and decoder_weights.bin, written next to the decoders by
+    /// scripts/share_decoder_weights.py; ONNX Runtime only shares initializers it is handed,
+    /// so without them every decoder session holds its own packed copy of the weights.
+    ///
+    /// Shared weights are used in place from one read-only mapping, and their packed GEMM
+    /// buffers are computed once for all sessions, so a second model adds no decoder weights.
+    /// All of it is freed with the last model using it. Decoder sessions with shared weights
+    /// skip optimized_model_cache_dir. Off, the sessions of a models directory read the
+    /// weights file on their own; a bundle is then mapped per model.
+    bool share_decoder_weights = true;
+
+    /// Directory for graph-optimized copies of the models. When set, each model is optimized
+    /// once and saved under a name derived from a hash of its contents and the ONNX Runtime
+    /// version, and later loads skip most of the optimization work. Empty disables the cache.
+    std::string optimized_model_cache_dir;
+
+    /// Run warm_up() at the end of construction.
+    bool warm_up = false;
+
+    /// Run voice activity detection in generate() before the models, so that leading and
+    /// trailing silence is trimmed and long pauses split the audio into segments that are
+    /// decoded separately.
+    bool use_vad = false;
+
+    /// Voice activity detection parameters, used when use_vad is set.
+    VadOptions vad;
+
+    /// Run the ONNX Runtime profiler on every session. Each session writes its own JSON
+    /// trace, which is finished by MoonshineModel::end_profiling().
+    bool enable_profiling = false;
+
+    /// Path prefix of the profiler traces. The model name and a timestamp are appended.
+    std::string profile_prefix = "moonshine";
+
+    /// Settings of the preprocessing session.
+    SessionConfig preprocess_session;
+
+    /// Settings of the encoder session.
+    SessionConfig encode_session;
+
+    /// Settings of the decoder session that runs the first step of every utterance.
+    SessionConfig uncached_decode_session;
+
+    /// Settings of the decoder session that runs the token loop.
+    SessionConfig cached_decode_session;
+
+    /// Arena registered with the shared Env by the first model that has a session with
+    /// SessionConfig::use_shared_arena set. Later models share it as it was configured.
+    ArenaConfig shared_arena;
+
+    /// Precision of the model files to load. Every file is checked on load for the inputs
+    /// and outputs the code binds, so a variant exported with different names or with
+    /// float16 inputs fails with a message naming the file instead of at the first run.
+    ModelPrecisions precision;
+};
+
+/**
+ * @struct ModelBuffers
+ * @brief Serialized models and tokenizer provided by the caller, e.g. linked into the binary.
+ *
+ * ONNX Runtime copies what it keeps while the sessions are created, so the buffers only
+ * need to stay valid during the MoonshineModel constructor. None of them may be empty.
+ */
+struct ModelBuffers
+{
+    std::string_view preprocess;       ///< Contents of preprocess.onnx.
+    std::string_view encode;           ///< Contents of encode.onnx.
+    std::string_view uncached_decode;  ///< Contents of uncached_decode.onnx.
+    std::string_view cached_decode;    ///< Contents of cached_decode.onnx.
+    std::string_view tokenizer;        ///< Contents of tokenizer.json.
+};
+
+/**
+ * @struct LongFormOptions
+ * @brief Chunking and parallelism settings for MoonshineModel::transcribe_long().
+ */
+struct LongFormOptions
+{
+    /// Target length of a chunk in seconds. Each cut is moved to the quietest point within
+    /// boundary_search_seconds of the target, so chunks end up somewhat longer or shorter.
+    float chunk_seconds = 20.0f;
+
+    /// Seconds of audio before every cut that are decoded again at the start of the next
+    /// chunk, so that a word clipped at the cut is recognized whole in one of the two.
+    float overlap_seconds = 1.0f;
+
+    /// Distance in seconds around each target cut that is searched for the quietest point.
+    float boundary_search_seconds = 2.0f;
+
+    /// Chunks decoded at the same time. 0 uses one per hardware thread. Keep the product of
+    /// this and RuntimeOptions::intra_op_num_threads at or below the number of cores.
+    size_t num_threads = 0;
+};
+
+/**
+ * @class CancellationToken
+ * @brief Stops generate() calls from another thread.
+ *
+ * One token may be shared by several calls. cancel() makes each of them return before its
+ * next decoder step and terminates any ONNX Runtime run they have in flight, so a cancelled
+ * request stops using the CPU right away. A cancelled token stays cancelled.
+ */
+class CancellationToken
+{
+   public:
+    /**
+     * @brief Cancel every call using this token, including ones started later.
+     */
+    void cancel();
+
+    /**
+     * @brief Check whether cancel() has been called.
+     * @return True once the token is cancelled.
+     */
+    bool cancelled() const;
+
+   private:
+    friend class MoonshineModel;
+
+    /**
+     * @brief Register the run options of a call, terminating them if already cancelled.
+     * @param run_options The run options, which must stay valid until detach().
+     */
+    void attach(Ort::RunOptions &run_options);
+
+    /**
+     * @brief Unregister the run options of a finished call.
+     * @param run_options The run options passed to attach().
+     */
+    void detach(Ort::RunOptions &run_options);
+
+    std::atomic<bool> cancelled_{false};   ///< Set by cancel().
+    std::mutex mutex_;                     ///< Guards runs_.
+    std::vector<Ort::RunOptions *> runs_;  ///< Run options of the calls in flight.
+};
+
+/**
+ * @enum StopReason
+ * @brief Why a generate() call stopped producing tokens.
+ */
+enum class StopReason
+{
+    EndToken,    ///< The model produced the end token.
+    MaxLength,   ///< The token budget was used up.
+    Callback,    ///< The token callback returned false.
+    Cancelled,   ///< The cancellation token was cancelled.
+    StopToken,   ///< The model produced one of GenerateOptions::stop_tokens.
+    Repetition,  ///< The output ended in a loop of a repeated n-gram.
+    Deadline,    ///< GenerateOptions::deadline passed.
+};
+
+/**
+ * @struct GeneratedToken
+ * @brief A token reported to the callback of generate() as soon as it is produced.
+ */
+struct GeneratedToken
+{
+    int32_t token = 0;             ///< The token ID.
+    std::string_view text;         ///< Text the token adds; valid during the callback only.
+    double step_seconds = 0.0;     ///< Time since the previous token or the call began.
+    double elapsed_seconds = 0.0;  ///< Time since the call began.
+    float log_prob = 0.0f;         ///< Log probability; 0 unless GenerateOptions::log_probs.
+};
+
+/**
+ * @brief Callback invoked for every generated token except the end token.
+ * @return False to stop generating after this token.
+ */
+using TokenCallback = std::function<bool(const GeneratedToken &)>;
+
+/**
+ * @struct GenerateStats
+ * @brief Stage timings and sizes of one generate() call.
+ *
+ * With voice activity detection, the model stages add up over all speech segments.
+ */
+struct GenerateStats
+{
+    double vad_seconds = 0.0;              ///< Wall time of voice activity detection.
+    double preprocess_seconds = 0.0;       ///< Wall time of the preprocessing model.
+    double encode_seconds = 0.0;           ///< Wall time of the encoding model.
+    double uncached_decode_seconds = 0.0;  ///< Wall time of the first decoder step.
+    double total_seconds = 0.0;            ///< Wall time of the whole call.
+    size_t token_count = 0;                ///< Generated tokens, not counting the start token.
+    double audio_seconds = 0.0;            ///< Duration of the input audio.
+
+    /// Wall time of each cached decoder step, in order.
+    std::vector<double> cached_decode_seconds;
+
+    /// total_seconds divided by audio_seconds; below 1 is faster than real time.
+    double real_time_factor = 0.0;
+
+    /// Bytes of output tensors allocated by ONNX Runtime rather than bound to preallocated
+    /// buffers. Once the decoder has learned its cache layout, only the preprocessing,
+    /// encoding and first decoder outputs are allocated per call.
+    size_t ort_allocated_bytes = 0;
+};
+
+/**
+ * @struct GenerateOptions
+ * @brief Per-call settings for MoonshineModel::generate().
+ */
+struct GenerateOptions
+{
+    /// The maximum number of tokens to generate. 0 derives the limit from the audio length.
+    size_t max_len = 0;
+
+    /// Token budget per second of audio, used when max_len is 0. With voice activity
+    /// detection, each speech segment gets a budget for its own length.
+    float max_tokens_per_second = 6.0f;
+
+    /// Stop once the output ends with this many back-to-back copies of the same n-gram, which
+    /// is how the decoder loops on noise. The copies stay in the result. 0 disables the check,
+    /// which is the default so that output is unchanged unless asked for. Single tokens count
+    /// as n-grams too, and speech such as "no, no, no" repeats them legitimately, so keep this
+    /// at 8 or more unless the output is checked; a loop that long is seldom real speech.
+    size_t repetition_count = 0;
+
+    /// Longest n-gram, in tokens, checked for repetition.
+    size_t repetition_max_ngram = 8;
+
+    /// Tokens that end generation like the end token does. They are kept in the result.
+    std::vector<int32_t> stop_tokens;
+
+    /// Tokens that are never generated. Their logits are masked before every step selects a
+    /// token, so they get no probability either.
+    std::vector<int32_t> suppress_tokens;
+
+    /// Compute the log probability of every generated token, for GeneratedToken::log_prob and
+    /// GenerateResult::log_probs. It comes from the same pass over the logits that selects
+    /// the token, which then also sums their exponentials.
+    bool log_probs = false;
+
+    /// Number of hypotheses kept by beam search; 1 decodes greedily. The beams are stacked on
+    /// the batch axis of the decoder, so a step over all of them costs about as much as one
+    /// greedy step over a batch of beam_width. With beam search, tokens reach on_token only
+    /// once the search has finished.
+    size_t beam_width = 1;
+
+    /// Finished hypotheses are ranked by their summed log probability divided by their length
+    /// raised to this power. 0 ranks by the plain sum, which favors short outputs.
+    float beam_length_penalty = 1.0f;
+
+    /// Time by which generation stops, checked before every decoder step. The tokens produced
+    /// until then are returned.
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+    /// Called on the decoding thread after every token, before the next decoder step runs.
+    /// Keep it short; it delays the next token.
+    TokenCallback on_token;
+
+    /// Optional token that stops the call from another thread. Must outlive the call.
+    CancellationToken *cancel = nullptr;
+
+    /// Optional stats, overwritten with the figures of the call.
+    GenerateStats *stats = nullptr;
+};
+
+/**
+ * @struct GenerateResult
+ * @brief Tokens produced by MoonshineModel::generate() and why generation stopped.
+ */
+struct GenerateResult
+{
+    std::vector<int32_t> tokens;                    ///< Start token, then the generated tokens.
+    StopReason stop_reason = StopReason::EndToken;  ///< Why generation stopped.
+
+    /// Log probability of each entry of tokens, 0 for the start token. Empty unless
+    /// GenerateOptions::log_probs. Low values flag transcripts worth a second look.
+    std::vector<float> log_probs;
+};
 
 /**
  * @class MoonshineModel
  * @brief A class to handle the ONNX model inference for the Moonshine project.
+ *
+ * generate() and generate_batch() may be called from any number of threads at once on the
+ * same model. The sessions are only read, and each in-flight call decodes with its own
+ * bindings and KV-cache buffers, which are recycled across calls.
  */
 class MoonshineModel
 {
    public:
     /**
      * @brief Constructor for the MoonshineModel class.
-     * @param models_dir The directory containing the ONNX model files.
+     *
+     * models_dir may also name a bundle file written by scripts/pack_bundle.py, which is
+     * memory-mapped; the sessions are created from its byte ranges and the tokenizer is
+     * parsed in place. The sessions still copy their weights out of the mapping, except
+     * decoder weights shared as described at RuntimeOptions::share_decoder_weights. See
+     * ModelBundle.
+     *
+     * @param models_dir The directory containing the ONNX model files, or a model bundle.
+     * @param options Threading configuration for the ONNX Runtime sessions.
      */
-    explicit MoonshineModel(const std::string &models_dir);
+    explicit MoonshineModel(const std::string &models_dir,
+                            const RuntimeOptions &options = RuntimeOptions());
+
+    /**
+     * @brief Construct a model from serialized models in memory.
+     *
+     * RuntimeOptions::precision does not apply: the given models are loaded as they are.
+     * Decoders rewritten by scripts/share_decoder_weights.py cannot be loaded this way, as
+     * their weights are in a separate file.
+     *
+     * @param buffers The contents of the model files and the tokenizer.
+     * @param options Threading configuration for the ONNX Runtime sessions.
+     */
+    explicit MoonshineModel(const ModelBuffers &buffers,
+                            const RuntimeOptions &options = RuntimeOptions());
+
+    /**
+     * @brief Destructor for the MoonshineModel class.
+     */
+    ~MoonshineModel();
 
     /**
      * @brief Generate tokens from audio samples.
@@ -27,34 +483,304 @@ class MoonshineModel
      */
     std::vector<int32_t> generate(const std::vector<float> &audio_samples, size_t max_len = 0);
 
+    /**
+     * @brief Generate tokens from a range of audio samples.
+     *
+     * With RuntimeOptions::use_vad, only the detected speech is decoded. Each segment between
+     * long pauses is decoded on its own with a token budget of max_len, and the tokens are
+     * joined into one sequence. Audio without speech yields just the start and end tokens.
+     *
+     * @param audio_samples Normalized float32 audio samples in the range [-1.0, 1.0].
+     * @param sample_count The number of samples.
+     * @param max_len The maximum length of the generated tokens. Default is 0 (no limit).
+     * @return A vector of generated token IDs.
+     */
+    std::vector<int32_t> generate(const float *audio_samples, size_t sample_count,
+                                  size_t max_len = 0);
+
+    /**
+     * @brief Generate tokens from a range of audio samples, reporting each token as it is
+     * produced.
+     *
+     * Tokens are passed to options.on_token as soon as they are chosen, which lets callers
+     * show the first words long before the transcript is complete. The call ends early when
+     * the callback returns false or options.cancel is cancelled; the tokens produced until
+     * then are returned either way. The end token is only present when the model produced it.
+     *
+     * @param audio_samples Normalized float32 audio samples in the range [-1.0, 1.0].
+     * @param sample_count The number of samples.
+     * @param options Token budget, callback and cancellation token.
+     * @return The generated token IDs and the reason generation stopped.
+     */
+    GenerateResult generate(const float *audio_samples, size_t sample_count,
+                            const GenerateOptions &options);
+
+    /**
+     * @brief Generate tokens for a batch of utterances in one pass over the models.
+     *
+     * Shorter utterances are padded with trailing silence up to the longest one, since the
+     * models take no attention mask. Batching clips of similar length keeps that padding
+     * small. Sequences are dropped from the batch as soon as they produce the end token or
+     * reach their token budget, and the remaining ones keep decoding.
+     *
+     * @param audio_batch The utterances, each as normalized float32 samples in [-1.0, 1.0].
+     * @param max_len The maximum length of the generated tokens per utterance. Default is 0,
+     * which derives the limit from the length of each utterance at the default
+     * GenerateOptions::max_tokens_per_second, as generate() does.
+     * @return One vector of generated token IDs per utterance, in input order.
+     */
+    std::vector<std::vector<int32_t>> generate_batch(
+        const std::vector<std::vector<float>> &audio_batch, size_t max_len = 0);
+
+    /**
+     * @brief Transcribe a recording of any length.
+     *
+     * The audio is cut into chunks at low-energy points, each chunk overlapping the previous
+     * one, and the chunks are decoded concurrently with generate(). The tokens of the overlap
+     * are matched between neighbouring chunks and kept only once in the result. Audio no
+     * longer than a single chunk is passed straight to generate().
+     *
+     * @param audio_samples Normalized float32 audio samples in the range [-1.0, 1.0].
+     * @param options Chunking and parallelism settings.
+     * @return A vector of generated token IDs for the whole recording.
+     */
+    std::vector<int32_t> transcribe_long(const std::vector<float> &audio_samples,
+                                         const LongFormOptions &options = LongFormOptions());
+
+    /**
+     * @brief Run one generate() pass over synthetic audio.
+     *
+     * ONNX Runtime plans memory and grows its arenas on the first run of each session, and
+     * the decoder learns its KV-cache layout on its first cached step. Warming up moves that
+     * cost out of the first real request.
+     */
+    void warm_up();
+
     /**
      * @brief Detokenize the generated tokens into a string.
      * @param tokens A vector of token IDs.
      * @return A detokenized string.
      */
-    std::string detokenize(const std::vector<int32_t> &tokens);
+    std::string detokenize(const std::vector<int32_t> &tokens) const;
+
+    /**
+     * @brief Detokenize the generated tokens into a caller-provided string, which is cleared
+     * first and keeps its capacity across calls.
+     * @param tokens A vector of token IDs.
+     * @param text Receives the detokenized text.
+     */
+    void detokenize(const std::vector<int32_t> &tokens, std::string &text) const;
+
+    /**
+     * @brief Get the token table, e.g. to detokenize a stream with an IncrementalDetokenizer.
+     * @return The tokenizer loaded from the models directory.
+     */
+    const Tokenizer &tokenizer() const;
+
+    /**
+     * @brief Get the ONNX Runtime environment the sessions were created in, e.g. to create a
+     * VoiceActivityDetector with a model in the same Env.
+     * @return The environment.
+     */
+    std::shared_ptr<Ort::Env> env() const;
+
+    /**
+     * @brief Stop the ONNX Runtime profiler and write its traces.
+     *
+     * Only has an effect when RuntimeOptions::enable_profiling is set. Later runs are not
+     * profiled.
+     *
+     * @return The paths of the trace files, one per session, or none without profiling.
+     */
+    std::vector<std::string> end_profiling();
+
+    /**
+     * @brief Get the ONNX Runtime environment shared by every model in the process.
+     *
+     * The Env is created on first use. When options.use_global_thread_pools is set, it is
+     * created with global intra-op and inter-op thread pools sized from options, and all
+     * models using global pools run on them. Later calls return the existing Env.
+     *
+     * @param options The threading configuration used if the Env does not exist yet.
+     * @return The process-wide environment.
+     * @throws std::runtime_error if global thread pools are requested but the Env was
+     * already created without them.
+     */
+    static std::shared_ptr<Ort::Env> shared_env(const RuntimeOptions &options);
 
    private:
+    struct SharedWeights;  ///< Decoder initializers shared by sessions, and their packed forms.
+
+    std::shared_ptr<Ort::Env> env_;             ///< ONNX Runtime environment, shared across models.
+    std::shared_ptr<SharedWeights>
+        shared_weights_;                        ///< Shared decoder weights, if any.
+    RuntimeOptions options_;                    ///< Threading configuration for the sessions.
     std::unique_ptr<Ort::Session> preprocess_;  ///< ONNX session for the preprocessing model.
     std::unique_ptr<Ort::Session> encode_;      ///< ONNX session for the encoding model.
     std::unique_ptr<Ort::Session>
         uncached_decode_;  ///< ONNX session for the uncached decoding model.
     std::unique_ptr<Ort::Session> cached_decode_;  ///< ONNX session for the cached decoding model.
-    Ort::Env env_;                                 ///< ONNX Runtime environment.
     Ort::MemoryInfo memory_info_;                  ///< Memory information for ONNX Runtime.
+    std::unique_ptr<VoiceActivityDetector> vad_;   ///< Speech detector, if use_vad is set.
+
+    /**
+     * @brief Create the sessions, load the tokenizer and apply the remaining options.
+     * @param paths The model file of each session, or its name when loading from memory.
+     * @param models The serialized model of each session, or empty views to load the files.
+     * @param tokenizer_content The contents of tokenizer.json.
+     */
+    void initialize(const std::vector<std::string> &paths,
+                    const std::vector<std::string_view> &models,
+                    std::string_view tokenizer_content);
 
     /**
      * @brief Helper function to create an ONNX session.
-     * @param model_path The path to the ONNX model file.
+     * @param model The model the session runs, e.g. "cached_decode", to look up its shared
+     * weights.
+     * @param model_path The path to the ONNX model file, or its name if model_bytes is set.
+     * @param model_bytes The serialized model, or an empty view to load model_path.
+     * @param config The settings of the session.
      * @return A unique pointer to the created ONNX session.
      */
-    std::unique_ptr<Ort::Session> createSession(const std::string &model_path);
+    std::unique_ptr<Ort::Session> createSession(const char *model, const std::string &model_path,
+                                                std::string_view model_bytes,
+                                                const SessionConfig &config);
+
+    /**
+     * @brief Get the shared decoder weights of a weights file, loading them unless a model in
+     * the process holds them already.
+     * @param key Identifies the weights file, e.g. by its canonical path.
+     * @param load Maps the weights file and creates the shared weights.
+     * @return The shared weights, which stay loaded while a model holds them.
+     */
+    static std::shared_ptr<SharedWeights> sharedWeights(
+        const std::string &key, const std::function<std::shared_ptr<SharedWeights>()> &load);
+
+    /**
+     * @brief Check the inputs and outputs of every session against the names the code binds.
+     * @param paths The model file of each session, for the error messages.
+     * @throws std::runtime_error naming the file and tensor that do not match.
+     */
+    void validateSessions(const std::vector<std::string> &paths) const;
+
+    /**
+     * @brief Get the path of the graph-optimized copy of a model, creating it if needed.
+     * @param model_path The path to the original ONNX model file, or its name.
+     * @param model_bytes The serialized model, or an empty view to read model_path.
+     * @param session_options The options the model will be loaded with.
+     * @return The path of the optimized model in the cache directory.
+     */
+    std::string optimizedModelPath(const std::string &model_path, std::string_view model_bytes,
+                                   const Ort::SessionOptions &session_options);
+
+    struct DecoderState;  ///< Bindings and preallocated KV-cache buffers for the token loop.
+    std::vector<std::unique_ptr<DecoderState>> idle_decoder_states_;  ///< States not in use.
+    std::mutex decoder_states_mutex_;  ///< Guards idle_decoder_states_.
+
+    /**
+     * @brief Take an idle decoder state, or create one if all of them are in use.
+     * @return A decoder state owned by the caller until it is released.
+     */
+    std::unique_ptr<DecoderState> acquireDecoderState();
+
+    /**
+     * @brief Return a decoder state to the idle pool for reuse by later calls.
+     * @param state The state to return.
+     */
+    void releaseDecoderState(std::unique_ptr<DecoderState> state);
+
+    struct EncoderBuffers;  ///< Bound encoder inputs and outputs for one length bucket.
+    std::vector<size_t> bucket_samples_;  ///< Bucket lengths in samples, ascending.
+    std::vector<std::vector<std::unique_ptr<EncoderBuffers>>>
+        idle_encoder_buffers_;          ///< Buffers not in use, per bucket.
+    std::mutex encoder_buffers_mutex_;  ///< Guards idle_encoder_buffers_.
+
+    /**
+     * @brief Take idle encoder buffers of a bucket, or create them if all are in use.
+     * @param bucket The index of the bucket.
+     * @return Buffers that return to the idle pool when the last reference is dropped.
+     */
+    std::shared_ptr<EncoderBuffers> acquireEncoderBuffers(size_t bucket);
+
+    /**
+     * @brief Run the preprocessing and encoding models over a batch of audio.
+     * @param audio The audio samples, laid out as [batch, samples].
+     * @param batch The number of utterances.
+     * @param samples The number of samples per utterance.
+     * @param seq_len Receives the sequence length of the preprocessed audio.
+     * @param run_options Run options for both models.
+     * @param stats Optional stats to add the stage timings and output sizes to.
+     * @return The encoder outputs; the first one holds the context.
+     */
+    std::vector<Ort::Value> encode(float *audio, size_t batch, size_t samples, int32_t &seq_len,
+                                   const Ort::RunOptions &run_options,
+                                   GenerateStats *stats = nullptr);
 
-    std::map<int, std::string> token_id_to_token_;  ///< Map from token IDs to token strings.
+    struct GenerateCall;    ///< Options, run options and timing of one generate() call.
+    struct EncodedSegment;  ///< Encoder output of one speech segment.
+    struct EncodedRequest;  ///< A generate() call between its encode and decode stages.
+    friend class TranscriptionPipeline;
 
     /**
-     * @brief Load the tokenizer from a JSON string.
-     * @param tokenizer_content The JSON string containing the tokenizer data.
+     * @brief First half of generate(): detect speech and run the preprocessing and encoding
+     * models over every segment.
+     * @param audio_samples Normalized float32 audio samples in the range [-1.0, 1.0]. They are
+     * not referenced after the call returns.
+     * @param sample_count The number of samples.
+     * @param options Options of the call, which must outlive the returned request.
+     * @return The encoded request, ready for decodeRequest().
      */
-    void load_tokenizer(const std::string &tokenizer_content);
+    std::shared_ptr<EncodedRequest> encodeRequest(const float *audio_samples, size_t sample_count,
+                                                  const GenerateOptions &options);
+
+    /**
+     * @brief Second half of generate(): run the token loop over every encoded segment.
+     * @param request A request returned by encodeRequest().
+     * @return The generated token IDs and the reason generation stopped.
+     */
+    GenerateResult decodeRequest(EncodedRequest &request);
+
+    /**
+     * @brief Run the uncached and cached decoders over an encoded batch.
+     * @param context The encoder output, bound once for the whole token loop. Rows of
+     * finished sequences are compacted away in place.
+     * @param seq_len The sequence length passed to the first decoder step.
+     * @param max_lens The maximum number of tokens to generate for each sequence.
+     * @param tokens The generated tokens are appended to the vector of each sequence.
+     * @param run_options Run options for every decoder step.
+     * @param call The generate() call to report tokens and the stop reason to, when decoding
+     * a single utterance for it, or null.
+     */
+    void decode(Ort::Value &context, int32_t seq_len, const std::vector<size_t> &max_lens,
+                std::vector<std::vector<int32_t>> &tokens, const Ort::RunOptions &run_options,
+                GenerateCall *call = nullptr);
+
+    /**
+     * @brief Decode one encoded utterance with beam search.
+     *
+     * The encoder context is copied once per beam for the whole search, and every step
+     * decodes all live beams in one cached decoder call. After each step the KV cache rows
+     * are gathered to the parents of the surviving beams, so a beam that spawns several
+     * successors shares its cache without recomputation.
+     *
+     * @param context The encoder output of a single utterance.
+     * @param seq_len The sequence length passed to the first decoder step.
+     * @param max_len The maximum number of tokens to generate.
+     * @param tokens Receives the best hypothesis, starting with the start token.
+     * @param call The generate() call with the beam settings. Its log_probs receive the log
+     * probability of each token of the best hypothesis.
+     */
+    void decodeBeams(Ort::Value &context, int32_t seq_len, size_t max_len,
+                     std::vector<int32_t> &tokens, GenerateCall &call);
+
+    /**
+     * @brief Pass a new token and the text it adds to the callback of a call.
+     * @param call The generate() call with the callback.
+     * @param token The token ID.
+     * @param log_prob The log probability of the token, if computed.
+     * @return The callback's result; false stops generation.
+     */
+    bool reportToken(GenerateCall &call, int32_t token, float log_prob);
+
+    Tokenizer tokenizer_;  ///< Token table used for detokenization.
 };
@@ -0,0 +1,90 @@
+#include "pipeline.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+struct TranscriptionPipeline::Job
+{
+    std::vector<float> audio;                                 ///< Input audio, freed once encoded.
+    GenerateOptions options;                                  ///< Options of the request.
+    std::promise<GenerateResult> promise;                     ///< Receives the result.
+    std::shared_ptr<MoonshineModel::EncodedRequest> request;  ///< Output of the encode stage.
+};
+
+TranscriptionPipeline::TranscriptionPipeline(MoonshineModel &model,
+                                             const PipelineOptions &options)
+    : model_(model), submitted_(options.queue_capacity), encoded_(options.queue_capacity)
+{
+    for (size_t i = 0; i < std::max<size_t>(1, options.encode_threads); ++i)
+    {
+        encode_threads_.emplace_back(&TranscriptionPipeline::encodeLoop, this);
+    }
+    for (size_t i = 0; i < std::max<size_t>(1, options.decode_threads); ++i)
+    {
+        decode_threads_.emplace_back(&TranscriptionPipeline::decodeLoop, this);
+    }
+}
+
+TranscriptionPipeline::~TranscriptionPipeline()
+{
+    // Drain the stages in order, so every submitted request still gets its result
+    submitted_.close();
+    for (auto &thread : encode_threads_)
+    {
+        thread.join();
+    }
+    encoded_.close();
+    for (auto &thread : decode_threads_)
+    {
+        thread.join();
+    }
+}
+
+std::future<GenerateResult> TranscriptionPipeline::submit(std::vector<float> audio_samples,
+                                                          const GenerateOptions &options)
+{
+    auto job = std::make_unique<Job>();
+    job->audio = std::move(audio_samples);
+    job->options = options;
+    std::future<GenerateResult> result = job->promise.get_future();
+    if (!submitted_.push(std::move(job)))
+    {
+        throw std::runtime_error("TranscriptionPipeline is shutting down");
+    }
+    return result;
+}
+
+void TranscriptionPipeline::encodeLoop()
+{
+    std::unique_ptr<Job> job;
+    while (submitted_.pop(job))
+    {
+        try
+        {
+            job->request = model_.encodeRequest(job->audio.data(), job->audio.size(), job->options);
+            job->audio = std::vector<float>();
+        }
+        catch (...)
+        {
+            job->promise.set_exception(std::current_exception());
+            continue;
+        }
+        encoded_.push(std::move(job));
+    }
+}
+
+void TranscriptionPipeline::decodeLoop()
+{
+    std::unique_ptr<Job> job;
+    while (encoded_.pop(job))
+    {
+        try
+        {
+            job->promise.set_value(model_.decodeRequest(*job->request));
+        }
+        catch (...)
+        {
+            job->promise.set_exception(std::current_exception());
+        }
+        job.reset();
+    }
+}
@@ -0,0 +1,164 @@
+// pipeline.hpp
+#pragma once
+#include "moonshine.hpp"
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @class BoundedQueue
+ * @brief Blocking FIFO queue with a fixed capacity.
+ *
+ * push() waits while the queue is full, which passes backpressure on to the producer.
+ * After close(), push() fails and pop() drains the remaining items before failing.
+ */
+template <typename T>
+class BoundedQueue
+{
+   public:
+    /**
+     * @brief Constructor for the BoundedQueue class.
+     * @param capacity The maximum number of queued items; at least 1.
+     */
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity > 0 ? capacity : 1)
+    {
+    }
+
+    /**
+     * @brief Add an item, waiting for space if the queue is full.
+     * @param item The item to add.
+     * @return False if the queue was closed, in which case the item is dropped.
+     */
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+        if (closed_)
+        {
+            return false;
+        }
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Remove the oldest item, waiting for one if the queue is empty.
+     * @param item Receives the item.
+     * @return False once the queue is closed and empty.
+     */
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if (items_.empty())
+        {
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Stop accepting items and wake every waiting thread.
+     */
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+   private:
+    const size_t capacity_;              ///< Maximum number of queued items.
+    std::deque<T> items_;                ///< Queued items, oldest first.
+    bool closed_ = false;                ///< Set by close().
+    std::mutex mutex_;                   ///< Guards items_ and closed_.
+    std::condition_variable not_full_;   ///< Signalled when an item is removed.
+    std::condition_variable not_empty_;  ///< Signalled when an item is added.
+};
+
+/**
+ * @struct PipelineOptions
+ * @brief Stage sizes of a TranscriptionPipeline.
+ */
+struct PipelineOptions
+{
+    /// Capacity of each of the two queues: requests waiting for the encoder, and encoded
+    /// requests waiting for a decoder. submit() blocks while the first one is full.
+    size_t queue_capacity = 4;
+
+    /// Threads running the preprocessing and encoding models.
+    size_t encode_threads = 1;
+
+    /// Threads running the token loop.
+    size_t decode_threads = 1;
+};
+
+/**
+ * @class TranscriptionPipeline
+ * @brief Asynchronous transcription with the encoder and the decoder as separate stages.
+ *
+ * While one request is in the token loop, the next ones are already being encoded on other
+ * threads, so the compute-bound encoder and the latency-bound decoder overlap. Results are
+ * the same as from MoonshineModel::generate().
+ *
+ * Each stage thread runs the ONNX Runtime sessions with their own intra-op pools, so keep
+ * (encode_threads + decode_threads) * intra_op_num_threads at or below the number of cores.
+ * GenerateStats::total_seconds includes the time a request waits between the stages.
+ */
+class TranscriptionPipeline
+{
+   public:
+    /**
+     * @brief Constructor for the TranscriptionPipeline class. Starts the stage threads.
+     * @param model The model used for inference, which must outlive the pipeline.
+     * @param options Stage sizes.
+     */
+    explicit TranscriptionPipeline(MoonshineModel &model,
+                                   const PipelineOptions &options = PipelineOptions());
+
+    /**
+     * @brief Destructor. Finishes every submitted request, then stops the stage threads.
+     */
+    ~TranscriptionPipeline();
+
+    TranscriptionPipeline(const TranscriptionPipeline &) = delete;
+    TranscriptionPipeline &operator=(const TranscriptionPipeline &) = delete;
+
+    /**
+     * @brief Queue audio for transcription, waiting while the pipeline is full.
+     * @param audio_samples Normalized float32 audio samples in the range [-1.0, 1.0].
+     * @param options Per-request options. The callback runs on a decode thread, and the
+     * cancellation token and stats must stay valid until the result is ready.
+     * @return A future for the generated tokens; it holds the exception if the request fails.
+     */
+    std::future<GenerateResult> submit(std::vector<float> audio_samples,
+                                       const GenerateOptions &options = GenerateOptions());
+
+   private:
+    struct Job;  ///< A submitted request and its promise.
+
+    /**
+     * @brief Body of an encode thread: encode queued requests until the queue is closed.
+     */
+    void encodeLoop();
+
+    /**
+     * @brief Body of a decode thread: decode encoded requests until the queue is closed.
+     */
+    void decodeLoop();
+
+    MoonshineModel &model_;                         ///< The model used for inference.
+    BoundedQueue<std::unique_ptr<Job>> submitted_;  ///< Requests waiting for the encoder.
+    BoundedQueue<std::unique_ptr<Job>> encoded_;    ///< Requests waiting for a decoder.
+    std::vector<std::thread> encode_threads_;       ///< Threads of the encode stage.
+    std::vector<std::thread> decode_threads_;       ///< Threads of the decode stage.
+};
@@ -0,0 +1,106 @@
+// ring_buffer.hpp
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/**
+ * @class SpscRingBuffer
+ * @brief Lock-free ring buffer for exactly one producer thread and one consumer thread.
+ *
+ * write() and read() never block, lock or allocate, so write() is safe to call from a
+ * real-time audio callback. When the buffer is full, write() stores what fits and reports
+ * how much that was; the caller decides whether to count the rest as dropped.
+ *
+ * @tparam T A trivially copyable element type.
+ */
+template <typename T>
+class SpscRingBuffer
+{
+   public:
+    /**
+     * @brief Constructor for the SpscRingBuffer class.
+     * @param capacity The minimum number of elements; rounded up to a power of two.
+     */
+    explicit SpscRingBuffer(size_t capacity)
+    {
+        size_t size = 1;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        buffer_.resize(size);
+        mask_ = size - 1;
+    }
+
+    /**
+     * @brief Get the number of elements the buffer can hold.
+     * @return The capacity.
+     */
+    size_t capacity() const
+    {
+        return buffer_.size();
+    }
+
+    /**
+     * @brief Get the number of elements waiting to be read. Exact only when called from the
+     * producer or consumer thread while the other side is idle.
+     * @return The number of buffered elements.
+     */
+    size_t size() const
+    {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Append elements. Must only be called from the producer thread.
+     * @param data The elements to append.
+     * @param count The number of elements.
+     * @return The number of elements stored, less than count if the buffer filled up.
+     */
+    size_t write(const T *data, size_t count)
+    {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        const size_t tail = tail_.load(std::memory_order_acquire);
+        const size_t n = std::min(count, buffer_.size() - (head - tail));
+
+        const size_t start = head & mask_;
+        const size_t first = std::min(n, buffer_.size() - start);
+        std::copy(data, data + first, buffer_.begin() + start);
+        std::copy(data + first, data + n, buffer_.begin());
+        head_.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+    /**
+     * @brief Take the oldest elements. Must only be called from the consumer thread.
+     * @param data Receives the elements.
+     * @param count The maximum number of elements to take.
+     * @return The number of elements taken, 0 if the buffer is empty.
+     */
+    size_t read(T *data, size_t count)
+    {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t head = head_.load(std::memory_order_acquire);
+        const size_t n = std::min(count, head - tail);
+
+        const size_t start = tail & mask_;
+        const size_t first = std::min(n, buffer_.size() - start);
+        std::copy(buffer_.begin() + start, buffer_.begin() + start + first, data);
+        std::copy(buffer_.begin(), buffer_.begin() + (n - first), data + first);
+        tail_.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+   private:
+    static constexpr size_t kCacheLineSize = 64;
+
+    std::vector<T> buffer_;  ///< Storage, indexed by position & mask_.
+    size_t mask_ = 0;        ///< capacity() - 1.
+
+    // The two positions live on separate cache lines so that the producer and the consumer
+    // do not invalidate each other's line on every update
+    alignas(kCacheLineSize) std::atomic<size_t> head_{0};  ///< Elements written so far.
+    alignas(kCacheLineSize) std::atomic<size_t> tail_{0};  ///< Elements read so far.
+};
@@ -0,0 +1,266 @@
+#include "streaming.hpp"
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+
+const size_t kSampleRate = 16000;
+const int32_t kStartToken = 1;
+const int32_t kEndToken = 2;
+
+// Agreed tokens left uncommitted, as they may be the start of a word still being spoken
+const size_t kHeldBackTokens = 2;
+
+// Distance before the estimated end of the committed tokens searched for a quiet cut
+const float kCutSearchSeconds = 0.5f;
+
+size_t toSamples(float seconds)
+{
+    return static_cast<size_t>(seconds * kSampleRate);
+}
+
+// Find the start of the quietest 10 ms frame in [begin, end), or begin if none fits
+size_t quietestFrame(const float *audio, size_t begin, size_t end)
+{
+    const size_t frame = kSampleRate / 100;
+    size_t best = begin;
+    float best_energy = std::numeric_limits<float>::max();
+    for (size_t start = begin; start + frame <= end; start += frame)
+    {
+        float energy = 0.0f;
+        for (size_t i = start; i < start + frame; ++i)
+        {
+            energy += audio[i] * audio[i];
+        }
+        if (energy < best_energy)
+        {
+            best_energy = energy;
+            best = start;
+        }
+    }
+    return best;
+}
+
+}  // namespace
+
+StreamingTranscriber::StreamingTranscriber(MoonshineModel &model, ResultCallback on_result,
+                                           const StreamingOptions &options)
+    : model_(model), on_result_(std::move(on_result)), options_(options),
+      vad_(options.vad, model.env())
+{
+}
+
+void StreamingTranscriber::push(const std::vector<float> &samples)
+{
+    push(samples.data(), samples.size());
+}
+
+void StreamingTranscriber::push(const float *samples, size_t count)
+{
+    audio_.insert(audio_.end(), samples, samples + count);
+    while (scanned_ + vad_.frame_size() <= audio_.size())
+    {
+        processFrame();
+    }
+
+    if (!in_speech_)
+    {
+        // Between utterances only the pre-roll is kept
+        const size_t preroll = toSamples(options_.preroll_seconds);
+        if (scanned_ > preroll)
+        {
+            const size_t drop = scanned_ - preroll;
+            audio_.erase(audio_.begin(), audio_.begin() + drop);
+            audio_offset_ += drop;
+            scanned_ -= drop;
+        }
+    }
+    else if (speech_end_ >= hypothesis_samples_ + toSamples(options_.partial_interval_seconds))
+    {
+        decodePartial();
+    }
+}
+
+void StreamingTranscriber::flush()
+{
+    if (in_speech_)
+    {
+        commit();
+    }
+}
+
+void StreamingTranscriber::processFrame()
+{
+    const size_t frame_size = vad_.frame_size();
+    const bool is_speech = vad_.process(audio_.data() + scanned_);
+    scanned_ += frame_size;
+
+    if (is_speech)
+    {
+        if (!in_speech_)
+        {
+            utterance_offset_ = audio_offset_;
+        }
+        in_speech_ = true;
+        speech_end_ = scanned_;
+        silence_samples_ = 0;
+    }
+    else if (in_speech_)
+    {
+        silence_samples_ += frame_size;
+    }
+    if (!in_speech_)
+    {
+        return;
+    }
+
+    // A short pause is enough to commit once the text has stopped changing
+    const bool stable = hypothesis_samples_ >= speech_end_ && !hypothesis_.empty() &&
+                        hypothesis_ == previous_hypothesis_;
+    if (silence_samples_ >= toSamples(options_.end_silence_seconds) ||
+        (stable && silence_samples_ >= toSamples(options_.commit_silence_seconds)) ||
+        scanned_ >= toSamples(options_.max_utterance_seconds))
+    {
+        commit();
+    }
+}
+
+void StreamingTranscriber::decodePartial()
+{
+    decode();
+    report(false);
+    commitPrefix();
+}
+
+void StreamingTranscriber::decode()
+{
+    // Only the uncommitted audio is decoded; committed utterances and committed prefixes of
+    // this one were dropped already
+    const std::vector<int32_t> tokens = model_.generate(audio_.data(), scanned_);
+    auto begin = tokens.begin();
+    auto end = tokens.end();
+    if (begin != end && *begin == kStartToken)
+    {
+        ++begin;
+    }
+    const bool ended = end != begin && end[-1] == kEndToken;
+    if (ended)
+    {
+        --end;
+    }
+    std::vector<int32_t> tail(begin, end);
+
+    // The overlap kept before the last cut decodes the end of the committed tokens again
+    for (size_t count = std::min(committed_.size(), tail.size()); count > 0; --count)
+    {
+        if (std::equal(committed_.end() - count, committed_.end(), tail.begin()))
+        {
+            tail.erase(tail.begin(), tail.begin() + count);
+            break;
+        }
+    }
+
+    previous_hypothesis_ = std::move(hypothesis_);
+    hypothesis_.assign(1, kStartToken);
+    hypothesis_.insert(hypothesis_.end(), committed_.begin(), committed_.end());
+    hypothesis_.insert(hypothesis_.end(), tail.begin(), tail.end());
+    if (ended)
+    {
+        hypothesis_.push_back(kEndToken);
+    }
+    hypothesis_samples_ = scanned_;
+
+    recent_tails_.push_back(std::move(tail));
+    if (recent_tails_.size() > std::max<size_t>(1, options_.prefix_agreement))
+    {
+        recent_tails_.erase(recent_tails_.begin());
+    }
+}
+
+void StreamingTranscriber::commitPrefix()
+{
+    const size_t agreement = std::max<size_t>(1, options_.prefix_agreement);
+    if (options_.prefix_commit_seconds <= 0.0f || recent_tails_.size() < agreement ||
+        hypothesis_samples_ < toSamples(options_.prefix_commit_seconds))
+    {
+        return;
+    }
+
+    const std::vector<int32_t> &latest = recent_tails_.back();
+    size_t agreed = latest.size();
+    for (const std::vector<int32_t> &tail : recent_tails_)
+    {
+        size_t count = 0;
+        while (count < agreed && count < tail.size() && tail[count] == latest[count])
+        {
+            ++count;
+        }
+        agreed = count;
+    }
+    if (agreed <= kHeldBackTokens)
+    {
+        return;
+    }
+    agreed -= kHeldBackTokens;
+
+    // Without token timestamps, take the tokens to be spread evenly over the decoded audio,
+    // and cut at the quietest point before the share of the committed ones
+    const size_t estimate = hypothesis_samples_ * agreed / latest.size();
+    const size_t search = toSamples(kCutSearchSeconds);
+    const size_t cut =
+        quietestFrame(audio_.data(), estimate > search ? estimate - search : 0, estimate);
+    const size_t overlap = toSamples(options_.prefix_overlap_seconds);
+    if (cut <= overlap)
+    {
+        return;
+    }
+    const size_t drop = cut - overlap;
+
+    committed_.insert(committed_.end(), latest.begin(), latest.begin() + agreed);
+    audio_.erase(audio_.begin(), audio_.begin() + drop);
+    audio_offset_ += drop;
+    scanned_ -= drop;
+    speech_end_ -= std::min(speech_end_, drop);
+    hypothesis_samples_ -= drop;
+    recent_tails_.clear();
+}
+
+void StreamingTranscriber::commit()
+{
+    if (hypothesis_samples_ < speech_end_)
+    {
+        decode();
+    }
+    report(true);
+
+    // Drop the committed audio; samples not yet classified stay for the next utterance
+    audio_.erase(audio_.begin(), audio_.begin() + scanned_);
+    audio_offset_ += scanned_;
+    scanned_ = 0;
+    in_speech_ = false;
+    speech_end_ = 0;
+    silence_samples_ = 0;
+    hypothesis_.clear();
+    previous_hypothesis_.clear();
+    hypothesis_samples_ = 0;
+    committed_.clear();
+    recent_tails_.clear();
+}
+
+void StreamingTranscriber::report(bool is_final)
+{
+    result_.tokens.assign(hypothesis_.begin(), hypothesis_.end());
+    model_.detokenize(hypothesis_, result_.text);
+    result_.is_final = is_final;
+    result_.stable_tokens = 0;
+    while (result_.stable_tokens < hypothesis_.size() &&
+           result_.stable_tokens < previous_hypothesis_.size() &&
+           hypothesis_[result_.stable_tokens] == previous_hypothesis_[result_.stable_tokens])
+    {
+        ++result_.stable_tokens;
+    }
+    result_.start_seconds = static_cast<double>(utterance_offset_) / kSampleRate;
+    result_.end_seconds = static_cast<double>(audio_offset_ + hypothesis_samples_) / kSampleRate;
+    on_result_(result_);
+}
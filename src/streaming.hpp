@@ -0,0 +1,171 @@
+// streaming.hpp
+#pragma once
+#include "moonshine.hpp"
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * @struct StreamingOptions
+ * @brief Segmentation and scheduling parameters for a StreamingTranscriber.
+ */
+struct StreamingOptions
+{
+    /// Speech detection parameters. Only the frame classification settings apply; the
+    /// segmentation below replaces the padding and splitting of VoiceActivityDetector::detect.
+    VadOptions vad;
+
+    /// Seconds of audio kept before the first speech frame of an utterance.
+    float preroll_seconds = 0.2f;
+
+    /// Seconds of new speech between two partial results.
+    float partial_interval_seconds = 0.3f;
+
+    /// Seconds of silence that end an utterance.
+    float end_silence_seconds = 0.8f;
+
+    /// Seconds of silence after which an utterance is committed early, provided its text
+    /// did not change between the last two partial results.
+    float commit_silence_seconds = 0.3f;
+
+    /// Utterances are committed once their undecided audio reaches this many seconds,
+    /// pause or not.
+    float max_utterance_seconds = 15.0f;
+
+    /// Seconds of undecided audio from which the stable start of a long utterance is
+    /// committed, so that later partial results only decode the audio after it. 0 disables
+    /// prefix commits, and every partial result decodes the whole utterance.
+    float prefix_commit_seconds = 4.0f;
+
+    /// Consecutive partial results that must agree on leading tokens before they are
+    /// committed.
+    size_t prefix_agreement = 2;
+
+    /// Seconds of audio kept before the cut of a prefix commit, so that a word clipped at
+    /// the cut is decoded whole again; its repeated tokens are removed by matching them
+    /// against the end of the committed ones.
+    float prefix_overlap_seconds = 0.5f;
+};
+
+/**
+ * @struct StreamingResult
+ * @brief A partial or final transcript of one utterance.
+ */
+struct StreamingResult
+{
+    std::string text;             ///< Detokenized transcript of the utterance so far.
+    std::vector<int32_t> tokens;  ///< Utterance token IDs, with start and end tokens.
+    size_t stable_tokens = 0;     ///< Leading tokens that match the previous partial result.
+    bool is_final = false;        ///< Whether the utterance is committed and will not change.
+    double start_seconds = 0;     ///< Stream time at which the utterance audio starts.
+    double end_seconds = 0;       ///< Stream time at which the transcribed audio ends.
+};
+
+/**
+ * @class StreamingTranscriber
+ * @brief Incremental transcription of a live audio stream.
+ *
+ * Incoming audio is split into utterances at pauses. Silence between utterances is dropped
+ * without running the models, and each partial result only decodes the audio that has not
+ * been committed yet. Once an utterance is committed, its audio is discarded.
+ *
+ * Within a long utterance, leading tokens that prefix_agreement partial results agree on
+ * are committed too, and the audio before them is dropped, so partial results keep decoding
+ * a tail of a few seconds instead of the whole utterance. The models give no token
+ * timestamps, so the cut is placed at the quietest point before the share of the audio the
+ * committed tokens take up in the text, and the last tokens of the agreed prefix are held
+ * back. A cut that still lands inside a word costs that word, which is why it can be
+ * disabled with prefix_commit_seconds.
+ *
+ * push() runs inference on the calling thread and invokes the callback from it. A
+ * transcriber must not be used from several threads at once, but several transcribers may
+ * share one model.
+ */
+class StreamingTranscriber
+{
+   public:
+    using ResultCallback = std::function<void(const StreamingResult &)>;
+
+    /**
+     * @brief Constructor for the StreamingTranscriber class.
+     * @param model The model used for inference; it must outlive the transcriber.
+     * @param on_result Called for every partial and final result.
+     * @param options Segmentation and scheduling parameters.
+     */
+    StreamingTranscriber(MoonshineModel &model, ResultCallback on_result,
+                         const StreamingOptions &options = StreamingOptions());
+
+    /**
+     * @brief Append audio to the stream.
+     * @param samples Normalized float32 samples at 16 kHz in the range [-1.0, 1.0].
+     * @param count The number of samples.
+     */
+    void push(const float *samples, size_t count);
+
+    /**
+     * @brief Append audio to the stream.
+     * @param samples Normalized float32 samples at 16 kHz in the range [-1.0, 1.0].
+     */
+    void push(const std::vector<float> &samples);
+
+    /**
+     * @brief Commit the current utterance, if any, as if the stream had paused.
+     */
+    void flush();
+
+   private:
+    /**
+     * @brief Classify the next frame and update the utterance state.
+     */
+    void processFrame();
+
+    /**
+     * @brief Decode the uncommitted audio and report it as a partial result.
+     */
+    void decodePartial();
+
+    /**
+     * @brief Decode the uncommitted audio into hypothesis_.
+     */
+    void decode();
+
+    /**
+     * @brief Commit the leading tokens the recent partial results agree on and drop the
+     * audio before them, if the undecided audio is long enough.
+     */
+    void commitPrefix();
+
+    /**
+     * @brief Report the current utterance as final and drop its audio.
+     */
+    void commit();
+
+    /**
+     * @brief Report a result for the current utterance.
+     * @param is_final Whether the result is final.
+     */
+    void report(bool is_final);
+
+    MoonshineModel &model_;     ///< The model used for inference.
+    ResultCallback on_result_;  ///< Receives partial and final results.
+    StreamingOptions options_;  ///< Segmentation and scheduling parameters.
+
+    VoiceActivityDetector vad_;  ///< Classifies frames as speech or silence.
+
+    std::vector<float> audio_;     ///< Uncommitted audio: the utterance and its pre-roll.
+    size_t audio_offset_ = 0;      ///< Stream position of audio_[0], in samples.
+    size_t utterance_offset_ = 0;  ///< Stream position where the utterance audio starts.
+    size_t scanned_ = 0;           ///< Samples of audio_ already classified into frames.
+    bool in_speech_ = false;       ///< Whether an utterance is in progress.
+    size_t speech_end_ = 0;        ///< End of the last speech frame in audio_.
+    size_t silence_samples_ = 0;   ///< Length of the silence since speech_end_.
+
+    std::vector<int32_t> hypothesis_;           ///< Tokens of the latest partial result.
+    std::vector<int32_t> previous_hypothesis_;  ///< Tokens of the partial result before it.
+    size_t hypothesis_samples_ = 0;             ///< Samples of audio_ decoded for hypothesis_.
+
+    std::vector<int32_t> committed_;                  ///< Tokens committed from dropped audio.
+    std::vector<std::vector<int32_t>> recent_tails_;  ///< Text tokens of the latest decodes.
+
+    StreamingResult result_;  ///< Reused for every report so its buffers keep their capacity.
+};
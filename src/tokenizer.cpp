@@ -0,0 +1,101 @@
+#include "tokenizer.hpp"
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+
+namespace
+{
+
+// The SentencePiece word marker '▁' (U+2581) in UTF-8
+const std::string_view kWordMarker = "\xE2\x96\x81";
+
+}  // namespace
+
+void Tokenizer::load(std::string_view tokenizer_content)
+{
+    nlohmann::json tokenizer =
+        nlohmann::json::parse(tokenizer_content.begin(), tokenizer_content.end());
+    const auto &vocab = tokenizer["model"]["vocab"];
+
+    // Token IDs are dense in practice, but gaps are allowed and stay empty
+    std::vector<std::string_view> texts;
+    size_t table_size = 0;
+    for (const auto &item : vocab.items())
+    {
+        const int64_t id = item.value().get<int64_t>();
+        if (id < 0)
+        {
+            throw std::runtime_error("Negative token ID in tokenizer: " + item.key());
+        }
+        if (static_cast<size_t>(id) >= texts.size())
+        {
+            texts.resize(static_cast<size_t>(id) + 1);
+        }
+        texts[static_cast<size_t>(id)] = item.key();
+        table_size += item.key().size();
+    }
+
+    table_.clear();
+    table_.reserve(table_size);
+    offsets_.assign(1, 0);
+    offsets_.reserve(texts.size() + 1);
+    for (std::string_view text : texts)
+    {
+        if (text.substr(0, kWordMarker.size()) == kWordMarker)
+        {
+            table_ += ' ';
+            text.remove_prefix(kWordMarker.size());
+        }
+        table_ += text;
+        offsets_.push_back(static_cast<uint32_t>(table_.size()));
+    }
+}
+
+size_t Tokenizer::size() const
+{
+    return offsets_.empty() ? 0 : offsets_.size() - 1;
+}
+
+std::string_view Tokenizer::token_text(int32_t token) const
+{
+    if (token < 0 || static_cast<size_t>(token) >= size())
+    {
+        return std::string_view();
+    }
+    return std::string_view(table_.data() + offsets_[token],
+                            offsets_[token + 1] - offsets_[token]);
+}
+
+void Tokenizer::detokenize(const int32_t *tokens, size_t count, std::string &text) const
+{
+    text.clear();
+    for (size_t i = 0; i < count; ++i)
+    {
+        std::string_view piece = token_text(tokens[i]);
+        // The transcript does not start with the space of its first word
+        if (text.empty() && !piece.empty() && piece[0] == ' ')
+        {
+            piece.remove_prefix(1);
+        }
+        text += piece;
+    }
+}
+
+IncrementalDetokenizer::IncrementalDetokenizer(const Tokenizer &tokenizer) : tokenizer_(tokenizer)
+{
+}
+
+std::string_view IncrementalDetokenizer::push(int32_t token)
+{
+    std::string_view piece = tokenizer_.token_text(token);
+    if (!started_ && !piece.empty() && piece[0] == ' ')
+    {
+        piece.remove_prefix(1);
+    }
+    started_ = started_ || !piece.empty();
+    return piece;
+}
+
+void IncrementalDetokenizer::reset()
+{
+    started_ = false;
+}
@@ -0,0 +1,89 @@
+// tokenizer.hpp
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @class Tokenizer
+ * @brief Token ID to text table for detokenizing model output.
+ *
+ * The text of every token is stored back to back in one string, with the SentencePiece
+ * word marker '▁' already replaced by a space, and found through an offset array indexed
+ * by token ID. Looking up a token is two array reads and never copies its text.
+ *
+ * All methods are const after load() and may be called from any number of threads.
+ */
+class Tokenizer
+{
+   public:
+    /**
+     * @brief Load the vocabulary from the contents of a tokenizer.json file.
+     * @param tokenizer_content The JSON string containing the tokenizer data, which is
+     * parsed in place and need not outlive the call.
+     */
+    void load(std::string_view tokenizer_content);
+
+    /**
+     * @brief Get the number of token IDs in the table.
+     * @return One past the largest token ID in the vocabulary.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Get the text of a token, with a leading '▁' turned into a space.
+     * @param token The token ID.
+     * @return A view into the table, or an empty view for unknown tokens.
+     */
+    std::string_view token_text(int32_t token) const;
+
+    /**
+     * @brief Detokenize tokens into a caller-provided string.
+     *
+     * The string is cleared first and keeps its capacity, so reusing it for every call
+     * avoids allocating once it has grown to the longest transcript.
+     *
+     * @param tokens The token IDs.
+     * @param count The number of tokens.
+     * @param text Receives the text, without a leading space.
+     */
+    void detokenize(const int32_t *tokens, size_t count, std::string &text) const;
+
+   private:
+    std::string table_;              ///< Text of every token, back to back.
+    std::vector<uint32_t> offsets_;  ///< Start of each token's text; one extra end entry.
+};
+
+/**
+ * @class IncrementalDetokenizer
+ * @brief Detokenizes a token stream one token at a time.
+ *
+ * Each push() returns only the text the new token adds, so the full transcript is never
+ * rebuilt. Joining the pieces gives the same text as Tokenizer::detokenize().
+ */
+class IncrementalDetokenizer
+{
+   public:
+    /**
+     * @brief Constructor for the IncrementalDetokenizer class.
+     * @param tokenizer The token table, which must outlive the detokenizer.
+     */
+    explicit IncrementalDetokenizer(const Tokenizer &tokenizer);
+
+    /**
+     * @brief Add a token to the stream.
+     * @param token The token ID.
+     * @return The text the token adds, as a view into the token table.
+     */
+    std::string_view push(int32_t token);
+
+    /**
+     * @brief Start a new stream.
+     */
+    void reset();
+
+   private:
+    const Tokenizer &tokenizer_;  ///< The token table.
+    bool started_ = false;        ///< Whether any text has been returned since reset().
+};
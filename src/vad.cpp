@@ -0,0 +1,198 @@
+#include "vad.hpp"
+#include "moonshine.hpp"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <stdexcept>
+
+namespace
+{
+
+const size_t kSampleRate = 16000;
+const size_t kEnergyFrameSize = kSampleRate / 100;  // 10 ms
+const size_t kModelFrameSize = 512;                 // 32 ms, fixed by Silero VAD v5
+const size_t kModelContextSize = 64;  // Samples of the previous frame fed with each frame
+const size_t kModelStateSize = 2 * 1 * 128;
+
+std::vector<const char *> vad_input_names = {"input", "state", "sr"};
+std::vector<const char *> vad_output_names = {"output", "stateN"};
+
+size_t toSamples(float seconds)
+{
+    return static_cast<size_t>(seconds * kSampleRate);
+}
+
+}  // namespace
+
+VoiceActivityDetector::VoiceActivityDetector(const VadOptions &options,
+                                             std::shared_ptr<Ort::Env> env)
+    : options_(options),
+      env_(std::move(env)),
+      memory_info_(Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU))
+{
+    if (!options_.model_path.empty())
+    {
+        if (!std::filesystem::exists(options_.model_path))
+        {
+            throw std::runtime_error("VAD model file not found: " + options_.model_path);
+        }
+
+        if (!env_)
+        {
+            env_ = MoonshineModel::shared_env(RuntimeOptions());
+        }
+        Ort::SessionOptions session_options;
+        session_options.SetIntraOpNumThreads(1);
+        session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+        const auto real_path = std::filesystem::path(options_.model_path).native();
+        session_ = std::make_unique<Ort::Session>(*env_, real_path.c_str(), session_options);
+    }
+    resetState(state_);
+}
+
+size_t VoiceActivityDetector::frame_size() const
+{
+    return session_ ? kModelFrameSize : kEnergyFrameSize;
+}
+
+bool VoiceActivityDetector::process(const float *frame)
+{
+    return classify(state_, frame);
+}
+
+void VoiceActivityDetector::reset()
+{
+    resetState(state_);
+}
+
+void VoiceActivityDetector::resetState(State &state) const
+{
+    state.in_speech = false;
+    if (session_)
+    {
+        state.input.assign(kModelContextSize + kModelFrameSize, 0.0f);
+        state.recurrent.assign(kModelStateSize, 0.0f);
+    }
+}
+
+bool VoiceActivityDetector::classify(State &state, const float *frame) const
+{
+    if (session_)
+    {
+        const float probability = modelProbability(state, frame);
+        state.in_speech = state.in_speech ? probability >= options_.model_stop_threshold
+                                          : probability >= options_.model_start_threshold;
+        return state.in_speech;
+    }
+
+    float energy = 0.0f;
+    size_t crossings = 0;
+    for (size_t i = 0; i < kEnergyFrameSize; ++i)
+    {
+        energy += frame[i] * frame[i];
+        if (i > 0 && (frame[i] >= 0.0f) != (frame[i - 1] >= 0.0f))
+        {
+            ++crossings;
+        }
+    }
+    const float rms = std::sqrt(energy / kEnergyFrameSize);
+    const float zero_crossing_rate = static_cast<float>(crossings) / (kEnergyFrameSize - 1);
+
+    if (state.in_speech)
+    {
+        state.in_speech = rms >= options_.stop_threshold;
+    }
+    else
+    {
+        state.in_speech = rms >= options_.start_threshold ||
+                          (rms >= options_.stop_threshold &&
+                           zero_crossing_rate >= options_.fricative_zero_crossing_rate);
+    }
+    return state.in_speech;
+}
+
+float VoiceActivityDetector::modelProbability(State &state, const float *frame) const
+{
+    std::copy(frame, frame + kModelFrameSize, state.input.begin() + kModelContextSize);
+
+    const int64_t input_shape[] = {1, static_cast<int64_t>(state.input.size())};
+    const int64_t state_shape[] = {2, 1, 128};
+    int64_t sample_rate = kSampleRate;
+    Ort::Value inputs[] = {
+        Ort::Value::CreateTensor<float>(memory_info_, state.input.data(), state.input.size(),
+                                        input_shape, 2),
+        Ort::Value::CreateTensor<float>(memory_info_, state.recurrent.data(),
+                                        state.recurrent.size(), state_shape, 3),
+        Ort::Value::CreateTensor<int64_t>(memory_info_, &sample_rate, 1, nullptr, 0),
+    };
+    auto outputs = session_->Run(Ort::RunOptions{nullptr}, vad_input_names.data(), inputs, 3,
+                                 vad_output_names.data(), vad_output_names.size());
+
+    const float *recurrent = outputs[1].GetTensorData<float>();
+    std::copy(recurrent, recurrent + kModelStateSize, state.recurrent.begin());
+    // The tail of this frame is the context of the next one
+    std::copy(state.input.end() - kModelContextSize, state.input.end(), state.input.begin());
+    return outputs[0].GetTensorData<float>()[0];
+}
+
+std::vector<SpeechSegment> VoiceActivityDetector::detect(const float *samples, size_t count) const
+{
+    State state;
+    resetState(state);
+
+    // Raw speech runs, frame by frame
+    const size_t frame = frame_size();
+    std::vector<SpeechSegment> runs;
+    bool active = false;
+    for (size_t position = 0; position + frame <= count; position += frame)
+    {
+        const bool speech = classify(state, samples + position);
+        if (speech && !active)
+        {
+            runs.push_back({position, count});
+        }
+        else if (!speech && active)
+        {
+            runs.back().end = position;
+        }
+        active = speech;
+    }
+
+    // Join runs separated by short pauses
+    const size_t split_silence = toSamples(options_.split_silence_seconds);
+    std::vector<SpeechSegment> joined;
+    for (const auto &run : runs)
+    {
+        if (!joined.empty() && run.start - joined.back().end < split_silence)
+        {
+            joined.back().end = run.end;
+        }
+        else
+        {
+            joined.push_back(run);
+        }
+    }
+
+    // Drop bursts too short to be speech and pad the rest, merging any that now overlap
+    const size_t min_speech = toSamples(options_.min_speech_seconds);
+    const size_t padding = toSamples(options_.padding_seconds);
+    std::vector<SpeechSegment> segments;
+    for (const auto &segment : joined)
+    {
+        if (segment.end - segment.start < min_speech)
+        {
+            continue;
+        }
+        const size_t start = segment.start > padding ? segment.start - padding : 0;
+        const size_t end = std::min(count, segment.end + padding);
+        if (!segments.empty() && start <= segments.back().end)
+        {
+            segments.back().end = end;
+        }
+        else
+        {
+            segments.push_back({start, end});
+        }
+    }
+    return segments;
+}
@@ -0,0 +1,155 @@
+// vad.hpp
+#pragma once
+#include <onnxruntime_cxx_api.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @struct VadOptions
+ * @brief Parameters of a VoiceActivityDetector.
+ */
+struct VadOptions
+{
+    /// RMS level of a frame that starts speech.
+    float start_threshold = 0.015f;
+
+    /// RMS level below which speech stops. Keeping it under start_threshold gives the
+    /// detector hysteresis, so speech does not flicker on and off around a single level.
+    float stop_threshold = 0.008f;
+
+    /// Quiet frames above stop_threshold still count as speech when at least this fraction
+    /// of their samples cross zero, which keeps fricatives such as "s" and "f" in a segment.
+    float fricative_zero_crossing_rate = 0.3f;
+
+    /// Speech segments shorter than this many seconds are dropped as noise.
+    float min_speech_seconds = 0.1f;
+
+    /// Seconds of audio kept before and after every speech segment.
+    float padding_seconds = 0.2f;
+
+    /// Pauses of at least this many seconds split speech into separate segments; shorter
+    /// ones are kept inside a segment.
+    float split_silence_seconds = 1.0f;
+
+    /// Optional path of a Silero-compatible ONNX VAD model (v5 inputs "input", "state" and
+    /// "sr"). When set, the model's speech probability replaces the energy detector.
+    std::string model_path;
+
+    /// Speech probability that starts speech when model_path is set.
+    float model_start_threshold = 0.5f;
+
+    /// Speech probability below which speech stops when model_path is set.
+    float model_stop_threshold = 0.35f;
+};
+
+/**
+ * @struct SpeechSegment
+ * @brief A range of samples that contains speech.
+ */
+struct SpeechSegment
+{
+    size_t start = 0;  ///< Index of the first sample.
+    size_t end = 0;    ///< Index one past the last sample.
+};
+
+/**
+ * @class VoiceActivityDetector
+ * @brief Frame-level speech detection on 16 kHz audio.
+ *
+ * By default frames are 10 ms and classified by energy and zero-crossing rate with
+ * hysteresis, which costs a few operations per sample. An ONNX VAD model can be used
+ * instead, in which case frames are 32 ms.
+ *
+ * detect() is const and may be called from several threads at once. process() keeps the
+ * state of one stream and must not be.
+ */
+class VoiceActivityDetector
+{
+   public:
+    /**
+     * @brief Constructor for the VoiceActivityDetector class.
+     *
+     * ONNX Runtime allows one Env per process, and whoever creates it fixes its threading.
+     * A detector created before any model with a null env creates the shared Env with
+     * default RuntimeOptions, and later models cannot use global thread pools. To avoid
+     * that, pass MoonshineModel::shared_env() with the RuntimeOptions of those models, or
+     * MoonshineModel::env() of an existing model.
+     *
+     * @param options Detection parameters.
+     * @param env The environment to create the session of model_path in. Null uses
+     * MoonshineModel::shared_env() with default options.
+     */
+    explicit VoiceActivityDetector(const VadOptions &options = VadOptions(),
+                                   std::shared_ptr<Ort::Env> env = nullptr);
+
+    /**
+     * @brief Get the number of samples in a frame.
+     * @return The frame size in samples.
+     */
+    size_t frame_size() const;
+
+    /**
+     * @brief Classify the next frame of a stream.
+     * @param frame frame_size() samples.
+     * @return Whether the stream is in speech after this frame.
+     */
+    bool process(const float *frame);
+
+    /**
+     * @brief Forget the state of the current stream.
+     */
+    void reset();
+
+    /**
+     * @brief Find the speech segments of a recording.
+     *
+     * Segments are padded by padding_seconds, separated by pauses of at least
+     * split_silence_seconds and at least min_speech_seconds long.
+     *
+     * @param samples Normalized float32 samples at 16 kHz.
+     * @param count The number of samples.
+     * @return The segments in order; empty if the recording contains no speech.
+     */
+    std::vector<SpeechSegment> detect(const float *samples, size_t count) const;
+
+   private:
+    /**
+     * @struct State
+     * @brief Per-stream detector state.
+     */
+    struct State
+    {
+        bool in_speech = false;        ///< Whether the stream is in speech.
+        std::vector<float> input;      ///< Model input: previous context and the frame.
+        std::vector<float> recurrent;  ///< Model recurrent state.
+    };
+
+    /**
+     * @brief Classify a frame and update the stream state.
+     * @param state The stream state.
+     * @param frame frame_size() samples.
+     * @return Whether the stream is in speech after this frame.
+     */
+    bool classify(State &state, const float *frame) const;
+
+    /**
+     * @brief Get the speech probability of a frame from the ONNX model.
+     * @param state The stream state.
+     * @param frame frame_size() samples.
+     * @return The speech probability.
+     */
+    float modelProbability(State &state, const float *frame) const;
+
+    /**
+     * @brief Reset a stream state.
+     * @param state The state to reset.
+     */
+    void resetState(State &state) const;
+
+    VadOptions options_;             ///< Detection parameters.
+    std::shared_ptr<Ort::Env> env_;  ///< ONNX Runtime environment for the model.
+    std::unique_ptr<Ort::Session> session_; ///< Optional ONNX VAD session.
+    Ort::MemoryInfo memory_info_;  ///< Memory information for ONNX Runtime.
+    State state_;                  ///< State of the stream fed to process().
+};